@@ -0,0 +1,366 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <stop_token>
+#include <utility>
+#include <vector>
+#include "executor.h"
+
+// Wakes up the one coroutine waiting on it, for a stage that waits on several things at once and looks at all of them
+// again when any changes. A notify with nobody waiting is kept for the next wait. Closing it (directly or through its
+// stop token) wakes the waiter up for good.
+class AsyncSignal
+{
+public:
+    explicit AsyncSignal(std::stop_token stopToken)
+        : m_onStop(std::move(stopToken), CloseOnStop{this})
+    {
+    }
+
+    AsyncSignal(const AsyncSignal&) = delete;
+    AsyncSignal& operator=(const AsyncSignal&) = delete;
+
+    class WaitAwaiter
+    {
+    public:
+        explicit WaitAwaiter(AsyncSignal& signal)
+            : m_signal(signal)
+        {
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            std::lock_guard<std::mutex> guard(m_signal.m_mutex);
+            if (m_signal.m_closed)
+            {
+                m_closed = true;
+                return false;
+            }
+            if (m_signal.m_notified)
+            {
+                m_signal.m_notified = false;
+                return false;
+            }
+
+            assert(m_signal.m_waiter == nullptr);
+            m_handle = handle;
+            m_executor = Executor::current();
+            assert(m_executor != nullptr);
+            m_signal.m_waiter = this;
+            return true;
+        }
+
+        // True means the signal was closed
+        bool await_resume() const noexcept { return m_closed; }
+
+    private:
+        friend class AsyncSignal;
+
+        AsyncSignal& m_signal;
+        bool m_closed = false;
+        std::coroutine_handle<> m_handle;
+        Executor* m_executor = nullptr;
+    };
+
+    // if (co_await signal.wait()) -> closed
+    WaitAwaiter wait() { return WaitAwaiter(*this); }
+
+    // Can be called from any thread, never suspends
+    void notify()
+    {
+        WaitAwaiter* waiter = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            waiter = std::exchange(m_waiter, nullptr);
+            m_notified = (waiter == nullptr);
+        }
+        if (waiter != nullptr)
+        {
+            waiter->m_executor->schedule(waiter->m_handle);
+        }
+    }
+
+    void close()
+    {
+        WaitAwaiter* waiter = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_closed = true;
+            waiter = std::exchange(m_waiter, nullptr);
+        }
+        if (waiter != nullptr)
+        {
+            waiter->m_closed = true;
+            waiter->m_executor->schedule(waiter->m_handle);
+        }
+    }
+
+private:
+    struct CloseOnStop
+    {
+        AsyncSignal* signal;
+        void operator()() const { signal->close(); }
+    };
+
+    std::mutex m_mutex;
+    WaitAwaiter* m_waiter = nullptr;
+    bool m_notified = false;
+    bool m_closed = false;
+
+    std::stop_callback<CloseOnStop> m_onStop;
+};
+
+// Bounded channel between coroutines. A full channel suspends the pusher and an empty one the popper, instead
+// of blocking the worker thread. Closing it (directly or through its stop token) wakes everybody up: pushes
+// then fail, pops keep returning what is left and fail once it's empty.
+template<typename T, std::size_t S>
+class AsyncChannel
+{
+public:
+    explicit AsyncChannel(std::stop_token stopToken)
+        : m_onStop(std::move(stopToken), CloseOnStop{this})
+    {
+    }
+
+    AsyncChannel(const AsyncChannel&) = delete;
+    AsyncChannel& operator=(const AsyncChannel&) = delete;
+
+    class PushAwaiter
+    {
+    public:
+        PushAwaiter(AsyncChannel& channel, T value)
+            : m_channel(channel)
+            , m_value(std::move(value))
+        {
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            std::unique_lock<std::mutex> guard(m_channel.m_mutex);
+            if (m_channel.m_closed)
+            {
+                m_closed = true;
+                return false;
+            }
+            if (m_channel.tryPushLocked(m_value, guard))
+            {
+                return false;
+            }
+
+            m_handle = handle;
+            m_executor = Executor::current();
+            assert(m_executor != nullptr);
+            m_channel.m_pushers.push_back(this);
+            return true;
+        }
+
+        // Same convention as the rest of the pipeline: true means the channel was closed and nothing was pushed
+        bool await_resume() const noexcept { return m_closed; }
+
+    private:
+        friend class AsyncChannel;
+
+        AsyncChannel& m_channel;
+        T m_value;
+        bool m_closed = false;
+        std::coroutine_handle<> m_handle;
+        Executor* m_executor = nullptr;
+    };
+
+    class PopAwaiter
+    {
+    public:
+        PopAwaiter(AsyncChannel& channel, T& value)
+            : m_channel(channel)
+            , m_value(value)
+        {
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            std::unique_lock<std::mutex> guard(m_channel.m_mutex);
+            if (m_channel.tryPopLocked(m_value, guard))
+            {
+                return false;
+            }
+            if (m_channel.m_closed)
+            {
+                m_closed = true;
+                return false;
+            }
+
+            m_handle = handle;
+            m_executor = Executor::current();
+            assert(m_executor != nullptr);
+            m_channel.m_poppers.push_back(this);
+            return true;
+        }
+
+        // True means the channel was closed and drained, value wasn't written
+        bool await_resume() const noexcept { return m_closed; }
+
+    private:
+        friend class AsyncChannel;
+
+        AsyncChannel& m_channel;
+        T& m_value;
+        bool m_closed = false;
+        std::coroutine_handle<> m_handle;
+        Executor* m_executor = nullptr;
+    };
+
+    // if (co_await channel.push(value)) -> closed
+    PushAwaiter push(T value) { return PushAwaiter(*this, std::move(value)); }
+
+    // if (co_await channel.pop(value)) -> closed and empty
+    PopAwaiter pop(T& value) { return PopAwaiter(*this, value); }
+
+    // Never suspends, usable from outside the executor. Returns false if the channel is full or closed, in which
+    // case value is left untouched and can be offered to another channel.
+    bool tryPush(T&& value)
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        return m_closed == false && tryPushLocked(value, guard);
+    }
+
+    bool tryPush(const T& value)
+    {
+        T copy = value;
+        return tryPush(std::move(copy));
+    }
+
+    // Never suspends. Returns false if nothing was available.
+    bool tryPop(T& value)
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        return tryPopLocked(value, guard);
+    }
+
+    void close()
+    {
+        std::deque<PushAwaiter*> pushers;
+        std::deque<PopAwaiter*> poppers;
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            if (m_closed)
+            {
+                return;
+            }
+            m_closed = true;
+            pushers.swap(m_pushers);
+            poppers.swap(m_poppers);
+        }
+
+        // Poppers only wait on an empty channel, so all of them are done
+        for (auto* pusher : pushers)
+        {
+            pusher->m_closed = true;
+            pusher->m_executor->schedule(pusher->m_handle);
+        }
+        for (auto* popper : poppers)
+        {
+            popper->m_closed = true;
+            popper->m_executor->schedule(popper->m_handle);
+        }
+    }
+
+    bool closed()
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        return m_closed;
+    }
+
+    std::size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+    std::size_t capacity() const { return S; }
+
+    // Notifies signal whenever a value is queued rather than handed to a waiting popper, for a consumer that doesn't
+    // only wait on this channel. Set before the channel is used.
+    void notifyOnPush(AsyncSignal& signal) { m_pushSignal = &signal; }
+
+private:
+    struct CloseOnStop
+    {
+        AsyncChannel* channel;
+        void operator()() const { channel->close(); }
+    };
+
+    // Both helpers unlock the guard before resuming anybody
+    bool tryPushLocked(T& value, std::unique_lock<std::mutex>& guard)
+    {
+        if (!m_poppers.empty())
+        {
+            // Hand the value straight to a waiting popper
+            PopAwaiter* popper = m_poppers.front();
+            m_poppers.pop_front();
+            popper->m_value = std::move(value);
+            guard.unlock();
+            popper->m_executor->schedule(popper->m_handle);
+            return true;
+        }
+
+        if (m_size == S)
+        {
+            return false;
+        }
+
+        m_data[(m_offset + m_size) % S] = std::move(value);
+        m_size++;
+        if (m_pushSignal != nullptr)
+        {
+            m_pushSignal->notify();
+        }
+        return true;
+    }
+
+    bool tryPopLocked(T& value, std::unique_lock<std::mutex>& guard)
+    {
+        if (m_size == 0)
+        {
+            return false;
+        }
+
+        value = std::move(m_data[m_offset]);
+        m_offset = (m_offset + 1) % S;
+        m_size--;
+
+        if (!m_pushers.empty())
+        {
+            // Room was just made, move a waiting pusher's value in
+            PushAwaiter* pusher = m_pushers.front();
+            m_pushers.pop_front();
+            m_data[(m_offset + m_size) % S] = std::move(pusher->m_value);
+            m_size++;
+            guard.unlock();
+            pusher->m_executor->schedule(pusher->m_handle);
+            if (m_pushSignal != nullptr)
+            {
+                m_pushSignal->notify();
+            }
+        }
+        return true;
+    }
+
+    std::mutex m_mutex;
+    std::array<T, S> m_data{};
+    std::atomic<std::size_t> m_size{};
+    std::size_t m_offset{};
+    bool m_closed = false;
+
+    std::deque<PushAwaiter*> m_pushers;
+    std::deque<PopAwaiter*> m_poppers;
+    AsyncSignal* m_pushSignal = nullptr;
+
+    std::stop_callback<CloseOnStop> m_onStop;
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <curl/curl.h>
+#include <iostream>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+#include "executor.h"
+#include "topology.h"
+
+// Runs every transfer of the pipeline on one curl multi handle, so a fetch is something a coroutine awaits
+// rather than a thread blocked in curl_easy_perform. Transfers still in flight when the stop token fires are
+// aborted. Given cpus, its thread is pinned to them.
+class CurlReactor
+{
+public:
+    explicit CurlReactor(std::stop_token stopToken, std::vector<unsigned> cpus = {})
+        : m_cpus(std::move(cpus))
+        , m_multi(curl_multi_init())
+        , m_onStop(std::move(stopToken), StopReactor{this})
+    {
+        // One transfer per connection rather than HTTP/2 multiplexing, so every fetcher keeps a connection of its own
+        // and the warmed up ones are what the fetchers reuse
+        curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_NOTHING);
+        curl_multi_setopt(m_multi, CURLMOPT_MAXCONNECTS, 1024L);
+        // Only once the multi handle is set up, it belongs to the reactor's thread from then on
+        m_thread = std::thread(&CurlReactor::run, this);
+    }
+
+    ~CurlReactor()
+    {
+        stop();
+        m_thread.join();
+        curl_multi_cleanup(m_multi);
+    }
+
+    CurlReactor(const CurlReactor&) = delete;
+    CurlReactor& operator=(const CurlReactor&) = delete;
+
+    class PerformAwaiter
+    {
+    public:
+        PerformAwaiter(CurlReactor& reactor, CURL* curl)
+            : m_reactor(reactor)
+            , m_curl(curl)
+        {
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            m_executor = Executor::current();
+            assert(m_executor != nullptr);
+            {
+                std::lock_guard<std::mutex> guard(m_reactor.m_mutex);
+                if (m_reactor.m_stop)
+                {
+                    return false;
+                }
+                m_reactor.m_pending.push_back(this);
+            }
+            curl_multi_wakeup(m_reactor.m_multi);
+            return true;
+        }
+
+        CURLcode await_resume() const noexcept { return m_result; }
+
+    private:
+        friend class CurlReactor;
+
+        CurlReactor& m_reactor;
+        CURL* m_curl;
+        CURLcode m_result = CURLE_ABORTED_BY_CALLBACK;
+        std::coroutine_handle<> m_handle;
+        Executor* m_executor = nullptr;
+    };
+
+    // CURLcode result = co_await reactor.perform(curl);
+    PerformAwaiter perform(CURL* curl) { return PerformAwaiter(*this, curl); }
+
+    std::size_t activeTransfers() const { return m_active.load(std::memory_order_relaxed); }
+
+private:
+    struct StopReactor
+    {
+        CurlReactor* reactor;
+        void operator()() const { reactor->stop(); }
+    };
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_stop = true;
+        }
+        curl_multi_wakeup(m_multi);
+    }
+
+    void complete(PerformAwaiter* transfer, CURLcode result)
+    {
+        transfer->m_result = result;
+        transfer->m_executor->schedule(transfer->m_handle);
+    }
+
+    void run()
+    {
+        pinCurrentThread(m_cpus);
+        std::vector<PerformAwaiter*> pending;
+        std::vector<PerformAwaiter*> inFlight;
+        bool stopping = false;
+
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> guard(m_mutex);
+                pending.swap(m_pending);
+                stopping = m_stop;
+            }
+
+            for (auto* transfer : pending)
+            {
+                if (stopping)
+                {
+                    complete(transfer, CURLE_ABORTED_BY_CALLBACK);
+                    continue;
+                }
+                curl_easy_setopt(transfer->m_curl, CURLOPT_PRIVATE, transfer);
+                curl_multi_add_handle(m_multi, transfer->m_curl);
+                inFlight.push_back(transfer);
+            }
+            pending.clear();
+
+            if (stopping)
+            {
+                for (auto* transfer : inFlight)
+                {
+                    curl_multi_remove_handle(m_multi, transfer->m_curl);
+                    complete(transfer, CURLE_ABORTED_BY_CALLBACK);
+                }
+                m_active = 0;
+                break;
+            }
+
+            int stillRunning = 0;
+            curl_multi_perform(m_multi, &stillRunning);
+
+            int messagesLeft = 0;
+            while (CURLMsg* message = curl_multi_info_read(m_multi, &messagesLeft))
+            {
+                if (message->msg != CURLMSG_DONE)
+                {
+                    continue;
+                }
+
+                PerformAwaiter* transfer = nullptr;
+                curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &transfer);
+                const CURLcode result = message->data.result;
+                curl_multi_remove_handle(m_multi, message->easy_handle);
+                std::erase(inFlight, transfer);
+                complete(transfer, result);
+            }
+            m_active.store(inFlight.size(), std::memory_order_relaxed);
+
+            curl_multi_poll(m_multi, nullptr, 0, 1000, nullptr);
+        }
+    }
+
+    std::vector<unsigned> m_cpus;
+    CURLM* m_multi;
+    std::mutex m_mutex;
+    std::vector<PerformAwaiter*> m_pending;
+    bool m_stop = false;
+    std::atomic<std::size_t> m_active{};
+    std::thread m_thread;
+    std::stop_callback<StopReactor> m_onStop;
+};
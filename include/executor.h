@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "topology.h"
+
+// Work-stealing pool running coroutines. Every worker owns a queue; a worker that runs dry steals from the
+// back of its neighbours' queues before going to sleep.
+// Given cpus, the workers are pinned to them: one core each when there are as many cores as workers, all of
+// them otherwise.
+class Executor
+{
+public:
+    explicit Executor(std::size_t threadCount, std::vector<unsigned> cpus = {})
+        : m_cpus(std::move(cpus))
+    {
+        threadCount = std::max<std::size_t>(threadCount, 1);
+        m_workers.reserve(threadCount);
+        for (auto i = 0UL; i < threadCount; i++)
+        {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+
+        m_threads.reserve(threadCount + 1);
+        for (auto i = 0UL; i < threadCount; i++)
+        {
+            m_threads.emplace_back(&Executor::run, this, i);
+        }
+        m_threads.emplace_back(&Executor::runTimers, this);
+    }
+
+    ~Executor()
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_sleepMutex);
+            m_stop = true;
+        }
+        m_sleepCondition.notify_all();
+        {
+            std::lock_guard<std::mutex> guard(m_timerMutex);
+            m_stopTimers = true;
+        }
+        m_timerCondition.notify_all();
+
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    // Can be called from any thread. From one of our workers, the coroutine goes on that worker's own queue.
+    void schedule(std::coroutine_handle<> handle)
+    {
+        const std::size_t index =
+            (t_current == this) ? t_workerIndex : m_nextWorker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+        {
+            std::lock_guard<std::mutex> guard(m_workers[index]->mutex);
+            m_workers[index]->tasks.push_back(handle);
+        }
+        {
+            std::lock_guard<std::mutex> guard(m_sleepMutex);
+            m_pending++;
+        }
+        m_sleepCondition.notify_one();
+    }
+
+    // Resumes handle on this executor once duration has passed
+    void scheduleAfter(std::chrono::steady_clock::duration duration, std::coroutine_handle<> handle)
+    {
+        scheduleAfter(duration, [this, handle] { schedule(handle); });
+    }
+
+    // Runs callback on the timer thread once duration has passed, so it must be short. Timers still pending when
+    // the executor is destroyed never run.
+    void scheduleAfter(std::chrono::steady_clock::duration duration, std::function<void()> callback)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_timerMutex);
+            m_timers.emplace(std::chrono::steady_clock::now() + duration, std::move(callback));
+        }
+        m_timerCondition.notify_one();
+    }
+
+    std::size_t threadCount() const { return m_workers.size(); }
+
+    // The executor running the calling thread, nullptr outside of a worker
+    static Executor* current() { return t_current; }
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::coroutine_handle<>> tasks;
+    };
+
+    bool take(std::size_t index, std::coroutine_handle<>& handle)
+    {
+        {
+            auto& own = *m_workers[index];
+            std::lock_guard<std::mutex> guard(own.mutex);
+            if (!own.tasks.empty())
+            {
+                handle = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+
+        for (auto offset = 1UL; offset < m_workers.size(); offset++)
+        {
+            auto& victim = *m_workers[(index + offset) % m_workers.size()];
+            std::lock_guard<std::mutex> guard(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                handle = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(std::size_t index)
+    {
+        pinCurrentThread(m_cpus.size() == m_workers.size() ? std::vector<unsigned>{m_cpus[index]} : m_cpus);
+        t_current = this;
+        t_workerIndex = index;
+
+        std::coroutine_handle<> handle;
+        while (true)
+        {
+            if (take(index, handle))
+            {
+                m_pending.fetch_sub(1, std::memory_order_relaxed);
+                handle.resume();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> guard(m_sleepMutex);
+            m_sleepCondition.wait(guard, [this] { return m_pending > 0 || m_stop == true; });
+            if (m_stop == true && m_pending == 0)
+            {
+                break;
+            }
+        }
+        t_current = nullptr;
+    }
+
+    void runTimers()
+    {
+        pinCurrentThread(m_cpus);
+        std::unique_lock<std::mutex> guard(m_timerMutex);
+        while (m_stopTimers == false)
+        {
+            if (m_timers.empty())
+            {
+                m_timerCondition.wait(guard);
+                continue;
+            }
+
+            auto first = m_timers.begin();
+            if (first->first > std::chrono::steady_clock::now())
+            {
+                m_timerCondition.wait_until(guard, first->first);
+                continue;
+            }
+
+            auto callback = std::move(first->second);
+            m_timers.erase(first);
+            guard.unlock();
+            callback();
+            guard.lock();
+        }
+    }
+
+    std::vector<unsigned> m_cpus;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    std::atomic<std::size_t> m_nextWorker{};
+
+    std::mutex m_sleepMutex;
+    std::condition_variable m_sleepCondition;
+    std::atomic<std::size_t> m_pending{};
+    bool m_stop = false;
+
+    std::mutex m_timerMutex;
+    std::condition_variable m_timerCondition;
+    std::multimap<std::chrono::steady_clock::time_point, std::function<void()>> m_timers;
+    bool m_stopTimers = false;
+
+    static inline thread_local Executor* t_current = nullptr;
+    static inline thread_local std::size_t t_workerIndex = 0;
+};
+
+struct SleepAwaiter
+{
+    std::chrono::steady_clock::duration duration;
+
+    bool await_ready() const noexcept { return duration.count() <= 0; }
+
+    void await_suspend(std::coroutine_handle<> handle) const
+    {
+        assert(Executor::current() != nullptr);
+        Executor::current()->scheduleAfter(duration, handle);
+    }
+
+    void await_resume() const noexcept {}
+};
+
+// co_await sleepFor(duration) suspends the coroutine without blocking its worker
+inline SleepAwaiter sleepFor(std::chrono::steady_clock::duration duration)
+{
+    return SleepAwaiter{duration};
+}
+
+struct YieldAwaiter
+{
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) const
+    {
+        assert(Executor::current() != nullptr);
+        Executor::current()->schedule(handle);
+    }
+
+    void await_resume() const noexcept {}
+};
+
+// co_await yieldNow() goes to the back of the worker's queue, for a loop that would otherwise keep its worker
+// as long as its input has data
+inline YieldAwaiter yieldNow()
+{
+    return YieldAwaiter{};
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <curl/curl.h>
+
+// Log-linear histogram of microsecond durations: 4 sub-buckets per power of two,
+// which keeps percentiles within ~20% of the real value without any allocation.
+class LatencyHistogram
+{
+public:
+    static constexpr std::size_t SubBuckets = 4;
+    static constexpr std::size_t BucketCount = 40 * SubBuckets;
+    using Snapshot = std::array<std::uint64_t, BucketCount>;
+
+    void record(std::uint64_t microseconds)
+    {
+        m_buckets[bucketIndex(microseconds)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshotAndReset()
+    {
+        Snapshot snapshot{};
+        for (auto i = 0UL; i < BucketCount; i++)
+        {
+            snapshot[i] = m_buckets[i].exchange(0, std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+
+    // Returns the upper bound (in microseconds) of the bucket holding the given percentile, 0 if empty
+    static std::uint64_t percentile(const Snapshot& snapshot, float percent)
+    {
+        std::uint64_t total = 0;
+        for (auto count : snapshot)
+        {
+            total += count;
+        }
+        if (total == 0)
+        {
+            return 0;
+        }
+
+        const auto target = static_cast<std::uint64_t>(static_cast<double>(total) * percent / 100.0 + 0.5);
+        std::uint64_t seen = 0;
+        for (auto i = 0UL; i < BucketCount; i++)
+        {
+            seen += snapshot[i];
+            if (seen >= target && snapshot[i] != 0)
+            {
+                return bucketUpperBound(i);
+            }
+        }
+        return bucketUpperBound(BucketCount - 1);
+    }
+
+private:
+    static std::size_t bucketIndex(std::uint64_t value)
+    {
+        if (value < SubBuckets)
+        {
+            return value;
+        }
+        const std::size_t exponent = std::bit_width(value) - 1;
+        const std::size_t subBucket = (value >> (exponent - 2)) & (SubBuckets - 1);
+        const std::size_t index = (exponent - 1) * SubBuckets + subBucket;
+        return index < BucketCount ? index : BucketCount - 1;
+    }
+
+    static std::uint64_t bucketUpperBound(std::size_t index)
+    {
+        if (index < SubBuckets)
+        {
+            return index;
+        }
+        const std::size_t exponent = index / SubBuckets + 1;
+        const std::size_t subBucket = index % SubBuckets;
+        return ((SubBuckets + subBucket + 1) << (exponent - 2)) - 1;
+    }
+
+    std::array<std::atomic<std::uint64_t>, BucketCount> m_buckets{};
+};
+
+// Connection reuse statistics shared by every fetch thread
+struct FetchStats
+{
+    std::atomic<std::uint64_t> requests{};
+    std::atomic<std::uint64_t> newConnections{};
+    std::atomic<std::uint64_t> reusedConnections{};
+    std::atomic<std::uint64_t> errors{};
+    LatencyHistogram connectTime;
+    LatencyHistogram tlsTime;
+
+    void record(CURL* curl, CURLcode result)
+    {
+        requests.fetch_add(1, std::memory_order_relaxed);
+        if (result != CURLE_OK)
+        {
+            errors.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        long connects = 0;
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+        if (connects == 0)
+        {
+            // The transfer went over a cached connection: no DNS lookup, TCP or TLS handshake
+            reusedConnections.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        newConnections.fetch_add(connects, std::memory_order_relaxed);
+
+        curl_off_t connectMicroseconds = 0;
+        curl_off_t appConnectMicroseconds = 0;
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connectMicroseconds);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appConnectMicroseconds);
+        connectTime.record(static_cast<std::uint64_t>(connectMicroseconds));
+        if (appConnectMicroseconds > connectMicroseconds)
+        {
+            tlsTime.record(static_cast<std::uint64_t>(appConnectMicroseconds - connectMicroseconds));
+        }
+    }
+};
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// A link on its way to (or back from) the fetchers
+struct FrontierLink
+{
+    // Host qualified: "en.wikipedia.org/wiki/Sun"
+    std::string link;
+    // BFS depth from the start page
+    std::uint16_t depth{};
+    // Number of times the filter saw this link so far
+    std::uint32_t inLinks{};
+    // Set by the filter when this is only an in-link count update for a link it already let through
+    bool rediscovered = false;
+};
+
+// "en.wikipedia.org/wiki/Sun" -> "en.wikipedia.org"
+static std::string_view hostOf(std::string_view link)
+{
+    return link.substr(0, link.find('/'));
+}
+
+static constexpr std::size_t InLinkTiers = 8;
+static constexpr std::size_t DepthTiers = 4;
+static constexpr std::size_t PriorityTiers = InLinkTiers * DepthTiers;
+
+// Tier 0 is fetched first. Most-linked pages win, BFS depth breaks ties. In-link counts are bucketed
+// by powers of two, so a link only changes tier when its count crosses one.
+static std::size_t priorityTier(std::uint16_t depth, std::uint32_t inLinks)
+{
+    const std::size_t inLinkTier = std::min<std::size_t>(std::bit_width(inLinks), InLinkTiers);
+    const std::size_t depthTier = std::min<std::size_t>(depth, DepthTiers - 1);
+    return (InLinkTiers - inLinkTier) * DepthTiers + depthTier;
+}
+
+// Bucketed priority queue of the links waiting to be fetched, with tiers of their own for every host so the best
+// link of one host can be taken without going through another host's backlog. Only used by the dispatch thread.
+class PriorityFrontier
+{
+public:
+    // Links are sorted by their host's index in hosts, a link of another host goes with the first one
+    explicit PriorityFrontier(std::vector<std::string> hosts)
+        : m_hosts(std::move(hosts))
+        , m_tiers(std::max<std::size_t>(m_hosts.size(), 1))
+    {
+    }
+
+    // Returns false if the link was already in the frontier (its priority is updated instead)
+    bool push(const FrontierLink& link)
+    {
+        auto [it, inserted] = m_entries.try_emplace(link.link, Entry{link.depth, link.inLinks, 0, hostIndex(link.link)});
+        if (!inserted)
+        {
+            bump(link.link, link.inLinks);
+            return false;
+        }
+
+        it->second.tier = priorityTier(link.depth, link.inLinks);
+        m_tiers[it->second.host][it->second.tier].push_back(link.link);
+        return true;
+    }
+
+    // Returns false if the link isn't held in memory (already fetched, or spilled to disk)
+    bool bump(const std::string& link, std::uint32_t inLinks)
+    {
+        auto it = m_entries.find(link);
+        if (it == m_entries.end())
+        {
+            return false;
+        }
+
+        auto& entry = it->second;
+        entry.inLinks = std::max(entry.inLinks, inLinks);
+        const std::size_t tier = priorityTier(entry.depth, entry.inLinks);
+        if (tier != entry.tier)
+        {
+            // The old copy is left behind and skipped when its tier is drained
+            entry.tier = tier;
+            m_tiers[entry.host][tier].push_back(link);
+        }
+        return true;
+    }
+
+    // Takes the best link of a host out of the frontier
+    bool pop(std::size_t host, FrontierLink& link)
+    {
+        for (auto tier = 0UL; tier < PriorityTiers; tier++)
+        {
+            if (take(host, tier, link))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Takes the worst link, of any host, out of the frontier to spill it
+    bool popWorst(FrontierLink& link)
+    {
+        for (auto tier = PriorityTiers; tier-- > 0;)
+        {
+            for (auto host = 0UL; host < m_tiers.size(); host++)
+            {
+                if (take(host, tier, link))
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Over every host, PriorityTiers when empty
+    std::size_t bestTier()
+    {
+        for (auto tier = 0UL; tier < PriorityTiers; tier++)
+        {
+            for (auto host = 0UL; host < m_tiers.size(); host++)
+            {
+                dropStale(host, tier);
+                if (!m_tiers[host][tier].empty())
+                {
+                    return tier;
+                }
+            }
+        }
+        return PriorityTiers;
+    }
+
+    std::size_t hostCount() const { return m_tiers.size(); }
+
+    std::size_t size() const { return m_entries.size(); }
+
+    bool empty() const { return m_entries.empty(); }
+
+private:
+    struct Entry
+    {
+        std::uint16_t depth;
+        std::uint32_t inLinks;
+        std::size_t tier;
+        std::size_t host;
+    };
+
+    // Few hosts, a linear search is fine
+    std::size_t hostIndex(std::string_view link) const
+    {
+        const auto it = std::find(m_hosts.begin(), m_hosts.end(), hostOf(link));
+        return it == m_hosts.end() ? 0 : it - m_hosts.begin();
+    }
+
+    void dropStale(std::size_t host, std::size_t tier)
+    {
+        auto& queue = m_tiers[host][tier];
+        while (!queue.empty())
+        {
+            auto it = m_entries.find(queue.front());
+            if (it != m_entries.end() && it->second.tier == tier)
+            {
+                return;
+            }
+            queue.pop_front();
+        }
+    }
+
+    bool take(std::size_t host, std::size_t tier, FrontierLink& link)
+    {
+        dropStale(host, tier);
+        auto& queue = m_tiers[host][tier];
+        if (queue.empty())
+        {
+            return false;
+        }
+
+        auto node = m_entries.extract(queue.front());
+        queue.pop_front();
+        link.link = std::move(node.key());
+        link.depth = node.mapped().depth;
+        link.inLinks = node.mapped().inLinks;
+        link.rediscovered = false;
+        return true;
+    }
+
+    std::vector<std::string> m_hosts;
+    std::vector<std::array<std::deque<std::string>, PriorityTiers>> m_tiers;
+    std::unordered_map<std::string, Entry> m_entries;
+};
+
+// Spilled links per priority tier: files waiting on disk, and the batch of each tier the serializer hasn't
+// filled yet. Written by the serializer, read by dispatch and deserializer.
+struct SpillIndex
+{
+    std::array<std::atomic<std::uint32_t>, PriorityTiers> files{};
+
+    // PriorityTiers when nothing is spilled
+    std::size_t bestTier() const
+    {
+        for (auto tier = 0UL; tier < PriorityTiers; tier++)
+        {
+            if (files[tier].load(std::memory_order_relaxed) != 0 || m_batched[tier].load(std::memory_order_relaxed) != 0)
+            {
+                return tier;
+            }
+        }
+        return PriorityTiers;
+    }
+
+    // Returns the tier's batch once it holds batchSize links, for the serializer to write
+    bool addToBatch(FrontierLink link, std::size_t batchSize, std::vector<FrontierLink>& full)
+    {
+        const std::size_t tier = priorityTier(link.depth, link.inLinks);
+        std::lock_guard<std::mutex> guard(m_batchMutex);
+        auto& batch = m_batches[tier];
+        batch.push_back(std::move(link));
+        if (batch.size() < batchSize)
+        {
+            m_batched[tier].store(batch.size(), std::memory_order_relaxed);
+            return false;
+        }
+        full.swap(batch);
+        batch.clear();
+        m_batched[tier].store(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Takes a tier's unfilled batch, so links that didn't make a whole file yet can still be read back
+    bool takeBatch(std::size_t tier, std::vector<FrontierLink>& links)
+    {
+        std::lock_guard<std::mutex> guard(m_batchMutex);
+        links.clear();
+        links.swap(m_batches[tier]);
+        m_batched[tier].store(0, std::memory_order_relaxed);
+        return !links.empty();
+    }
+
+private:
+    std::array<std::atomic<std::uint32_t>, PriorityTiers> m_batched{};
+    std::mutex m_batchMutex;
+    std::array<std::vector<FrontierLink>, PriorityTiers> m_batches;
+};
@@ -0,0 +1,415 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "async_channel.h"
+#include "executor.h"
+#include "frontier.h"
+
+struct HostPolicy
+{
+    std::string name;
+    // 0 means no limit
+    double requestsPerSecond = 0;
+};
+
+// Politeness across several wikis. Links wait in a ready queue per host, and every host has its own token bucket.
+// The fetchers await their next link here, and get it round robin over the hosts whose bucket allows one, so a
+// throttled host only ever delays itself. A host that throttles us anyway (Wikimedia error page) is paused, for
+// longer every time it happens in a row, and a rate limited one also has its rate halved before slowly getting it
+// back. Closing it (through its stop token) wakes up every waiting fetcher.
+//
+// Must outlive the executors of the fetchers, which run its timers.
+class HostScheduler
+{
+public:
+    // Links waiting per host before hasRoom() says no, the frontier keeps the rest until the host catches up. The
+    // room signal is notified once a host is down to half of it, so it gets topped up in batches.
+    static constexpr std::size_t ReadyCapacity = 64;
+
+    struct HostSnapshot
+    {
+        std::string_view name;
+        std::size_t ready;
+        double requestsPerSecond;
+        std::uint64_t served;
+        bool paused;
+    };
+
+    HostScheduler(const std::vector<HostPolicy>& hosts, std::stop_token stopToken)
+        : m_onStop(std::move(stopToken), CloseOnStop{this})
+    {
+        const auto now = std::chrono::steady_clock::now();
+        for (const auto& policy : hosts)
+        {
+            auto host = std::make_unique<Host>();
+            host->name = policy.name;
+            host->maxRate = policy.requestsPerSecond;
+            host->rate = policy.requestsPerSecond;
+            host->tokens = std::max(1.0, policy.requestsPerSecond);
+            host->lastRefill = now;
+            m_hosts.push_back(std::move(host));
+        }
+    }
+
+    HostScheduler(const HostScheduler&) = delete;
+    HostScheduler& operator=(const HostScheduler&) = delete;
+
+    class NextAwaiter
+    {
+    public:
+        NextAwaiter(HostScheduler& scheduler, FrontierLink& link)
+            : m_scheduler(scheduler)
+            , m_link(link)
+        {
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            m_executor = Executor::current();
+            assert(m_executor != nullptr);
+
+            std::lock_guard<std::mutex> guard(m_scheduler.m_mutex);
+            if (m_scheduler.m_closed)
+            {
+                m_closed = true;
+                return false;
+            }
+            // Stopping, wait stays zero and no timer is set
+            const auto now = std::chrono::steady_clock::now();
+            std::chrono::steady_clock::duration wait{};
+            if (m_scheduler.m_stopping == false && m_scheduler.takeLocked(m_link, now, wait))
+            {
+                return false;
+            }
+
+            m_scheduler.m_waiters.push_back(this);
+            m_scheduler.armTimerLocked(now, wait);
+            return true;
+        }
+
+        // True means the scheduler was closed, link wasn't written
+        bool await_resume() const noexcept { return m_closed; }
+
+    private:
+        friend class HostScheduler;
+
+        HostScheduler& m_scheduler;
+        FrontierLink& m_link;
+        bool m_closed = false;
+        std::coroutine_handle<> m_handle;
+        Executor* m_executor = nullptr;
+    };
+
+    // if (co_await scheduler.next(link)) -> closed. Otherwise link is the next one that may be fetched, of the first
+    // host after the last one served.
+    NextAwaiter next(FrontierLink& link) { return NextAwaiter(*this, link); }
+
+    // Whether more links for a host should be sent this way now. Hosts are numbered in the order of the policies.
+    bool hasRoom(std::size_t host)
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        return m_hosts[host]->ready.size() < ReadyCapacity;
+    }
+
+    // Notified when a host gets room for more links, and for every link coming back while stopping (for takeAny()).
+    // Set before the fetchers start.
+    void notifyOnRoom(AsyncSignal& signal) { m_roomSignal = &signal; }
+
+    // False if the link's host is unknown
+    bool enqueue(FrontierLink& link)
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        Host* host = find(link.link);
+        if (host == nullptr)
+        {
+            return false;
+        }
+        host->ready.push_back(std::move(link));
+        m_pending++;
+        serveLocked(guard);
+        return true;
+    }
+
+    // We got throttled on link: back off from its host and fetch it again later
+    void retryLater(FrontierLink link)
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        Host* host = find(link.link);
+        if (host == nullptr)
+        {
+            return;
+        }
+
+        // Fetches that were already in flight when we paused get throttled too, they don't make the pause longer
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= host->pausedUntil)
+        {
+            host->backOffStreak = (now - host->lastBackOff < std::chrono::minutes(1)) ? std::min(host->backOffStreak + 1, 6U) : 0;
+            host->lastBackOff = now;
+            host->pausedUntil = now + std::chrono::seconds(1U << host->backOffStreak);
+            if (host->maxRate > 0)
+            {
+                // The bucket starts filling again once the pause is over, not for the time spent paused
+                host->rate = std::max(host->maxRate / 64, host->rate / 2);
+                host->tokens = 0;
+                host->lastRefill = host->pausedUntil;
+            }
+        }
+
+        host->ready.push_front(std::move(link));
+        m_pending++;
+        if (m_stopping && m_roomSignal != nullptr)
+        {
+            m_roomSignal->notify();
+        }
+        // Nothing to hand out before the pause is over, but the fetchers waiting need a timer for it
+        serveLocked(guard);
+    }
+
+    // The fetchers get no more links, the ones waiting keep waiting until it's closed. For when the links left are
+    // to be saved rather than fetched, takeAny() gets them out.
+    void stopServing()
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stopping = true;
+    }
+
+    void close()
+    {
+        std::deque<NextAwaiter*> waiters;
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            if (m_closed)
+            {
+                return;
+            }
+            m_closed = true;
+            waiters.swap(m_waiters);
+        }
+
+        for (auto* waiter : waiters)
+        {
+            waiter->m_closed = true;
+            waiter->m_executor->schedule(waiter->m_handle);
+        }
+    }
+
+    // Any waiting link, ignoring rates and pauses. For saving them when stopping.
+    bool takeAny(FrontierLink& link)
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        for (auto& host : m_hosts)
+        {
+            if (!host->ready.empty())
+            {
+                link = std::move(host->ready.front());
+                host->ready.pop_front();
+                m_pending--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // In the order of the policies, fixed at construction
+    std::vector<std::string> hostNames() const
+    {
+        std::vector<std::string> names;
+        for (const auto& host : m_hosts)
+        {
+            names.push_back(host->name);
+        }
+        return names;
+    }
+
+    // Links waiting in every ready queue
+    std::size_t pending()
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        return m_pending;
+    }
+
+    // For the stats, resets the served counts
+    std::vector<HostSnapshot> snapshotAndReset()
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        const auto now = std::chrono::steady_clock::now();
+        std::vector<HostSnapshot> snapshot;
+        for (auto& host : m_hosts)
+        {
+            snapshot.push_back({host->name, host->ready.size(), host->rate, host->served, host->pausedUntil > now});
+            host->served = 0;
+        }
+        return snapshot;
+    }
+
+private:
+    struct Host
+    {
+        std::string name;
+        double maxRate = 0;
+        double rate = 0;
+        double tokens = 0;
+        std::chrono::steady_clock::time_point lastRefill;
+        std::chrono::steady_clock::time_point pausedUntil;
+        std::chrono::steady_clock::time_point lastBackOff;
+        std::uint32_t backOffStreak = 0;
+        std::deque<FrontierLink> ready;
+        std::uint64_t served = 0;
+    };
+
+    // The next link of the first host after the last one served that may be fetched now. Otherwise false, with wait
+    // set to how long until one could be (zero when no host has links waiting).
+    bool takeLocked(FrontierLink& link, std::chrono::steady_clock::time_point now, std::chrono::steady_clock::duration& wait)
+    {
+        wait = std::chrono::steady_clock::duration::max();
+        bool anyReady = false;
+
+        for (auto offset = 0UL; offset < m_hosts.size(); offset++)
+        {
+            const std::size_t index = (m_nextHost + offset) % m_hosts.size();
+            Host& host = *m_hosts[index];
+            if (host.ready.empty())
+            {
+                continue;
+            }
+            anyReady = true;
+
+            if (host.pausedUntil > now)
+            {
+                wait = std::min(wait, host.pausedUntil - now);
+                continue;
+            }
+
+            if (host.maxRate > 0)
+            {
+                const std::chrono::duration<double> elapsed = now - host.lastRefill;
+                // Bursts are capped at the current rate, so a host recovering from a back-off doesn't get a full one
+                host.tokens = std::min(std::max(1.0, host.rate), host.tokens + elapsed.count() * host.rate);
+                host.lastRefill = now;
+                if (host.tokens < 1)
+                {
+                    const auto untilToken = std::chrono::duration<double>((1 - host.tokens) / host.rate);
+                    wait = std::min(wait, std::chrono::duration_cast<std::chrono::steady_clock::duration>(untilToken));
+                    continue;
+                }
+                host.tokens -= 1;
+                // Additive recovery after a back off
+                host.rate = std::min(host.maxRate, host.rate + host.maxRate / 100);
+            }
+
+            link = std::move(host.ready.front());
+            host.ready.pop_front();
+            host.served++;
+            m_pending--;
+            m_nextHost = index + 1;
+            if (host.ready.size() == ReadyCapacity / 2 && m_roomSignal != nullptr)
+            {
+                m_roomSignal->notify();
+            }
+            return true;
+        }
+
+        if (!anyReady)
+        {
+            wait = std::chrono::steady_clock::duration::zero();
+        }
+        return false;
+    }
+
+    // Hands links to the waiting fetchers, in the order they came, for as long as a host allows it. Unlocks the
+    // guard before resuming them.
+    void serveLocked(std::unique_lock<std::mutex>& guard)
+    {
+        if (m_stopping || m_waiters.empty())
+        {
+            return;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::duration wait{};
+        std::vector<NextAwaiter*> served;
+        while (!m_waiters.empty() && takeLocked(m_waiters.front()->m_link, now, wait))
+        {
+            served.push_back(m_waiters.front());
+            m_waiters.pop_front();
+        }
+        armTimerLocked(now, wait);
+        guard.unlock();
+
+        for (auto* waiter : served)
+        {
+            waiter->m_executor->schedule(waiter->m_handle);
+        }
+    }
+
+    // With fetchers waiting on a host that will allow a fetch in wait, serve them again then. A timer already due
+    // by then does it.
+    void armTimerLocked(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::duration wait)
+    {
+        if (m_waiters.empty() || wait == std::chrono::steady_clock::duration::zero())
+        {
+            return;
+        }
+        if (m_timerAt > now && m_timerAt <= now + wait)
+        {
+            return;
+        }
+
+        m_timerAt = now + wait;
+        m_waiters.front()->m_executor->scheduleAfter(wait,
+                                                     [this]
+                                                     {
+                                                         std::unique_lock<std::mutex> guard(m_mutex);
+                                                         serveLocked(guard);
+                                                     });
+    }
+
+    // Few hosts, a linear search is fine
+    Host* find(std::string_view link)
+    {
+        const std::string_view name = hostOf(link);
+        for (auto& host : m_hosts)
+        {
+            if (host->name == name)
+            {
+                return host.get();
+            }
+        }
+        return nullptr;
+    }
+
+    struct CloseOnStop
+    {
+        HostScheduler* scheduler;
+        void operator()() const { scheduler->close(); }
+    };
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<Host>> m_hosts;
+    std::size_t m_nextHost = 0;
+    std::size_t m_pending = 0;
+
+    std::deque<NextAwaiter*> m_waiters;
+    AsyncSignal* m_roomSignal = nullptr;
+    // When the earliest pending timer fires
+    std::chrono::steady_clock::time_point m_timerAt;
+    bool m_stopping = false;
+    bool m_closed = false;
+
+    std::stop_callback<CloseOnStop> m_onStop;
+};
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <array>
 #include <curl/curl.h>
 #include <tuple>
 #include <string>
 #include <memory>
+#include <mutex>
 #include <iostream>
 
 static std::size_t writeFunction(void* ptr, std::size_t size, std::size_t nmemb, std::string* data)
@@ -12,7 +14,57 @@ static std::size_t writeFunction(void* ptr, std::size_t size, std::size_t nmemb,
     return size * nmemb;
 }
 
-static std::tuple<CURL*, std::unique_ptr<std::string>> initCurl()
+// DNS cache and TLS sessions shared by every easy handle, so a new connection resumes a session instead of
+// doing a full handshake. Connections themselves aren't shared here: libcurl doesn't support sharing them
+// between threads, they live in the curl reactor's pool instead.
+class CurlShare
+{
+public:
+    CurlShare()
+    {
+        m_share = curl_share_init();
+        if (m_share == nullptr)
+        {
+            std::cerr << "Couldn't init curl share" << std::endl;
+            return;
+        }
+
+        curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, lock);
+        curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, unlock);
+        curl_share_setopt(m_share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    ~CurlShare()
+    {
+        if (m_share != nullptr)
+        {
+            curl_share_cleanup(m_share);
+        }
+    }
+
+    CurlShare(const CurlShare&) = delete;
+    CurlShare& operator=(const CurlShare&) = delete;
+
+    CURLSH* get() { return m_share; }
+
+private:
+    static void lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr)
+    {
+        static_cast<CurlShare*>(userptr)->m_mutexes[data].lock();
+    }
+
+    static void unlock(CURL*, curl_lock_data data, void* userptr)
+    {
+        static_cast<CurlShare*>(userptr)->m_mutexes[data].unlock();
+    }
+
+    CURLSH* m_share = nullptr;
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> m_mutexes;
+};
+
+static std::tuple<CURL*, std::unique_ptr<std::string>> initCurl(CURLSH* share = nullptr)
 {
     CURL* curl = curl_easy_init();
     if (curl == nullptr)
@@ -27,5 +79,9 @@ static std::tuple<CURL*, std::unique_ptr<std::string>> initCurl()
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, responseString.get());
 
     curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    if (share != nullptr)
+    {
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    }
     return {curl, std::move(responseString)};
 }
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <lexbor/dom/collection.h>
+#include <lexbor/dom/dom.h>
+
+// Decides, while the page is still in the parser, which of its links are worth sending down the pipeline
+struct LinkExtractionPolicy
+{
+    // Only look at links under #mw-content-text instead of the whole body (sidebar, footer, language links...)
+    bool contentOnly = false;
+    // Ignore links that live inside navboxes and reference lists
+    bool skipNavigationBoxes = false;
+    // Namespaces ("" being the main/article namespace). An empty allow list allows everything not denied.
+    std::vector<std::string> allowedNamespaces;
+    std::vector<std::string> deniedNamespaces;
+
+    bool isAllowed(std::string_view link) const
+    {
+        if (allowedNamespaces.empty() && deniedNamespaces.empty())
+        {
+            return true;
+        }
+
+        const std::string_view linkNamespace = namespaceOf(link);
+        const auto matches = [linkNamespace](const auto& name) { return name == linkNamespace; };
+        if (std::any_of(deniedNamespaces.cbegin(), deniedNamespaces.cend(), matches))
+        {
+            return false;
+        }
+        return allowedNamespaces.empty() || std::any_of(allowedNamespaces.cbegin(), allowedNamespaces.cend(), matches);
+    }
+
+    // "/wiki/Help:Contents" -> "Help", "/wiki/Star_Wars:_Episode_IV" -> "" (not a namespace, just a colon in the title)
+    std::string_view namespaceOf(std::string_view link) const
+    {
+        constexpr std::string_view prefix = "/wiki/";
+        if (!link.starts_with(prefix))
+        {
+            return {};
+        }
+        link.remove_prefix(prefix.size());
+
+        const std::size_t colonPos = link.find(':');
+        if (colonPos == std::string_view::npos)
+        {
+            return {};
+        }
+
+        const std::string_view candidate = link.substr(0, colonPos);
+        const auto matches = [candidate](const auto& name) { return name == candidate; };
+        if (std::any_of(knownNamespaces.cbegin(), knownNamespaces.cend(), matches) ||
+            std::any_of(allowedNamespaces.cbegin(), allowedNamespaces.cend(), matches) ||
+            std::any_of(deniedNamespaces.cbegin(), deniedNamespaces.cend(), matches))
+        {
+            return candidate;
+        }
+        return {};
+    }
+
+    static constexpr std::array<std::string_view, 26> knownNamespaces = {
+        "Talk",          "User",           "User_talk",   "Wikipedia",     "Wikipedia_talk", "File",      "File_talk",
+        "MediaWiki",     "MediaWiki_talk", "Template",    "Template_talk", "Help",           "Help_talk", "Category",
+        "Category_talk", "Portal",         "Portal_talk", "Draft",         "Draft_talk",     "TimedText", "TimedText_talk",
+        "Module",        "Module_talk",    "Special",     "Media",         "Gadget"};
+};
+
+// Returns the #mw-content-text element, or nullptr when the page doesn't have one. Leaves the collection dirty.
+static lxb_dom_element_t* findContentRoot(lxb_dom_element_t* body, lxb_dom_collection_t* collection)
+{
+    auto status =
+        lxb_dom_elements_by_attr(body, collection, (const lxb_char_t*)"id", 2, (const lxb_char_t*)"mw-content-text", 15, false);
+    if (status != LXB_STATUS_OK || lxb_dom_collection_length(collection) == 0)
+    {
+        return nullptr;
+    }
+    return lxb_dom_collection_element(collection, 0);
+}
+
+static bool hasSkippedClass(lxb_dom_element_t* element)
+{
+    constexpr std::array<std::string_view, 6> skippedClasses = {
+        "navbox", "vertical-navbox", "reflist", "references", "mw-references-wrap", "refbegin"};
+
+    std::size_t classLen = 0;
+    const char* classAttribute = (const char*)lxb_dom_element_get_attribute(element, (const lxb_char_t*)"class", 5, &classLen);
+    if (classAttribute == nullptr)
+    {
+        return false;
+    }
+
+    std::string_view classes(classAttribute, classLen);
+    while (!classes.empty())
+    {
+        const std::size_t spacePos = classes.find(' ');
+        const std::string_view className = classes.substr(0, spacePos);
+        if (std::find(skippedClasses.cbegin(), skippedClasses.cend(), className) != skippedClasses.cend())
+        {
+            return true;
+        }
+        if (spacePos == std::string_view::npos)
+        {
+            break;
+        }
+        classes.remove_prefix(spacePos + 1);
+    }
+    return false;
+}
+
+// Walks up from a link to root looking for a navbox or reference list container
+static bool isInSkippedContainer(lxb_dom_element_t* element, lxb_dom_element_t* root)
+{
+    auto node = lxb_dom_interface_node(element)->parent;
+    const auto rootNode = lxb_dom_interface_node(root);
+    while (node != nullptr && node != rootNode && node->type == LXB_DOM_NODE_TYPE_ELEMENT)
+    {
+        if (hasSkippedClass(lxb_dom_interface_element(node)))
+        {
+            return true;
+        }
+        node = node->parent;
+    }
+    return false;
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "host_scheduler.h"
+#include "link_extraction.h"
+
+// Usage: wikipedia_parser [start_page] [data_folder] [--option...]
+struct Options
+{
+    // The start_page argument, then one per --start=<page>. "/wiki/Sun" starts from that page on every host,
+    // "fr.wikipedia.org/wiki/Soleil" on that one only. /wiki/Sun when none is given.
+    std::vector<std::string> startPages;
+    std::string dataFolder = "data/";
+    LinkExtractionPolicy linkPolicy;
+    // Where to write the Chrome trace (on SIGUSR1 and at exit). Tracing stays off when empty.
+    std::string tracePath;
+    // Write wiki_data as zstd compressed segments (see page_archive.h) instead of one file per page
+    bool compressOutput = false;
+    int compressionLevel = 3;
+    // Pin parsers to the cores of each NUMA node and keep everything else on a few service cores per node (see topology.h)
+    bool numaPlacement = false;
+    std::size_t serviceCoresPerNode = 1;
+    // Wikis to crawl, each with its own rate limit (--hosts=, --rate= for all of them, --host-rate=<host>=<req/s>)
+    std::vector<HostPolicy> hosts{{"en.wikipedia.org"}};
+};
+
+// "Main" stands for the article namespace, which has no prefix
+static std::vector<std::string> splitNamespaces(std::string_view list)
+{
+    std::vector<std::string> namespaces;
+    std::stringstream stream{std::string(list)};
+    std::string name;
+    while (std::getline(stream, name, ','))
+    {
+        namespaces.push_back(name == "Main" ? "" : name);
+    }
+    return namespaces;
+}
+
+// The value of a "--name=<number>" option. Anything that isn't entirely a valid T is reported like an
+// unknown option.
+template<typename T>
+static T parseNumber(std::string_view arg, std::string_view value)
+{
+    T number{};
+    const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+    if (value.empty() || error != std::errc() || end != value.data() + value.size())
+    {
+        std::cerr << "Invalid value in " << arg << std::endl;
+        exit(1);
+    }
+    return number;
+}
+
+// Requests per second, 0 for no limit
+static double parseRate(std::string_view arg, std::string_view value)
+{
+    const double rate = parseNumber<double>(arg, value);
+    if (!std::isfinite(rate) || rate < 0)
+    {
+        std::cerr << "Invalid value in " << arg << std::endl;
+        exit(1);
+    }
+    return rate;
+}
+
+static Options parseOptions(int argc, char** argv)
+{
+    Options options;
+    std::vector<std::string_view> positional;
+    double defaultRate = 0;
+    std::vector<std::pair<std::string_view, double>> hostRates;
+
+    for (auto i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        if (!arg.starts_with("--"))
+        {
+            positional.push_back(arg);
+        }
+        else if (arg == "--content-only")
+        {
+            options.linkPolicy.contentOnly = true;
+        }
+        else if (arg == "--skip-navboxes")
+        {
+            options.linkPolicy.skipNavigationBoxes = true;
+        }
+        else if (arg.starts_with("--allow-namespaces="))
+        {
+            options.linkPolicy.allowedNamespaces = splitNamespaces(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.starts_with("--deny-namespaces="))
+        {
+            options.linkPolicy.deniedNamespaces = splitNamespaces(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.starts_with("--start="))
+        {
+            options.startPages.emplace_back(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.starts_with("--trace="))
+        {
+            options.tracePath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg == "--compress")
+        {
+            options.compressOutput = true;
+        }
+        else if (arg.starts_with("--compression-level="))
+        {
+            options.compressOutput = true;
+            options.compressionLevel = parseNumber<int>(arg, arg.substr(arg.find('=') + 1));
+        }
+        else if (arg == "--numa")
+        {
+            options.numaPlacement = true;
+        }
+        else if (arg.starts_with("--service-cores-per-node="))
+        {
+            options.numaPlacement = true;
+            options.serviceCoresPerNode = parseNumber<std::size_t>(arg, arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.starts_with("--hosts="))
+        {
+            options.hosts.clear();
+            std::stringstream stream{std::string(arg.substr(arg.find('=') + 1))};
+            std::string host;
+            while (std::getline(stream, host, ','))
+            {
+                options.hosts.push_back({host, defaultRate});
+            }
+        }
+        else if (arg.starts_with("--rate="))
+        {
+            defaultRate = parseRate(arg, arg.substr(arg.find('=') + 1));
+            for (auto& host : options.hosts)
+            {
+                host.requestsPerSecond = defaultRate;
+            }
+        }
+        else if (arg.starts_with("--host-rate="))
+        {
+            const std::string_view hostRate = arg.substr(arg.find('=') + 1);
+            const std::size_t equalPos = hostRate.rfind('=');
+            if (equalPos == std::string_view::npos)
+            {
+                std::cerr << "Invalid value in " << arg << std::endl;
+                exit(1);
+            }
+            hostRates.emplace_back(hostRate.substr(0, equalPos), parseRate(arg, hostRate.substr(equalPos + 1)));
+        }
+        else
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            exit(1);
+        }
+    }
+
+    if (positional.size() > 0)
+    {
+        options.startPages.emplace(options.startPages.begin(), positional[0]);
+    }
+    if (options.startPages.empty())
+    {
+        options.startPages.emplace_back("/wiki/Sun");
+    }
+    if (positional.size() > 1)
+    {
+        options.dataFolder = positional[1];
+    }
+
+    for (const auto& [name, rate] : hostRates)
+    {
+        auto host = std::find_if(options.hosts.begin(), options.hosts.end(), [&](const HostPolicy& policy) { return policy.name == name; });
+        if (host == options.hosts.end())
+        {
+            std::cerr << "--host-rate given for " << name << ", which isn't in --hosts" << std::endl;
+            exit(1);
+        }
+        host->requestsPerSecond = rate;
+    }
+    return options;
+}
+
+// Host qualified links to start the crawl from
+static std::vector<std::string> seedLinks(const Options& options)
+{
+    std::vector<std::string> seeds;
+    for (const auto& page : options.startPages)
+    {
+        if (page.starts_with("/"))
+        {
+            for (const auto& host : options.hosts)
+            {
+                seeds.push_back(host.name + page);
+            }
+            continue;
+        }
+
+        if (std::none_of(options.hosts.begin(), options.hosts.end(), [&](const HostPolicy& host) { return host.name == hostOf(page); }))
+        {
+            std::cerr << "Start page " << page << " isn't on any of the crawled hosts" << std::endl;
+            exit(1);
+        }
+        seeds.push_back(page);
+    }
+    return seeds;
+}
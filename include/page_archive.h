@@ -0,0 +1,388 @@
+#pragma once
+
+// Compressed wiki_data format. Pages are appended to segment files (pages-000000.wpz, ...) as records:
+//   [varint name length][name][flags byte][varint raw size][varint payload size][payload]
+// The payload is the page's link list, front coded (see encodeLinks) then zstd compressed. Once enough pages
+// went through, a dictionary is trained on them and saved as links.dict; every later record uses it.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef WIKIPEDIA_PARSER_HAS_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+static constexpr std::string_view ArchiveMagic = "WPZ1";
+static constexpr std::string_view DictionaryFileName = "links.dict";
+static constexpr std::uint8_t RecordUsesDictionary = 1;
+
+// "en.wikipedia.org/wiki/Sun" -> "en.wikipedia.org/Sun", the path of its file in the plain wiki_data layout
+// (one folder per host). Names without a host ("/wiki/Sun") map to "Sun".
+static std::string pageFileName(std::string_view pageName)
+{
+    const std::size_t slashPos = pageName.find('/');
+    const std::string_view host = pageName.substr(0, slashPos);
+    std::string fileName(slashPos == std::string_view::npos ? "" : pageName.substr(slashPos));
+
+    std::replace(fileName.begin(), fileName.end(), '/', '_');
+    if (fileName.starts_with("_wiki_"))
+    {
+        fileName.erase(0, 6);
+    }
+    return host.empty() ? fileName : std::string(host) + '/' + fileName;
+}
+
+static void writeVarint(std::string& out, std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static bool readVarint(std::string_view& in, std::uint64_t& value)
+{
+    value = 0;
+    for (auto shift = 0; shift < 64 && !in.empty(); shift += 7)
+    {
+        const auto byte = static_cast<std::uint8_t>(in.front());
+        in.remove_prefix(1);
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool readVarint(std::istream& in, std::uint64_t& value)
+{
+    value = 0;
+    for (auto shift = 0; shift < 64; shift += 7)
+    {
+        const int byte = in.get();
+        if (byte == std::char_traits<char>::eof())
+        {
+            return false;
+        }
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Newline separated hrefs -> per link: [varint prefix shared with the previous link][varint (suffix size << 1 | has /wiki/)][suffix]
+// The /wiki/ prefix is dropped before comparing, so it costs one bit per link.
+static void encodeLinks(std::string_view links, std::string& out)
+{
+    constexpr std::string_view wikiPrefix = "/wiki/";
+    out.clear();
+
+    std::string_view previous;
+    while (!links.empty())
+    {
+        const std::size_t newlinePos = links.find('\n');
+        std::string_view link = links.substr(0, newlinePos);
+        links.remove_prefix(newlinePos == std::string_view::npos ? links.size() : newlinePos + 1);
+
+        const bool hasWikiPrefix = link.starts_with(wikiPrefix);
+        if (hasWikiPrefix)
+        {
+            link.remove_prefix(wikiPrefix.size());
+        }
+
+        const std::size_t shared = std::mismatch(link.begin(), link.end(), previous.begin(), previous.end()).first - link.begin();
+        writeVarint(out, shared);
+        writeVarint(out, ((link.size() - shared) << 1) | (hasWikiPrefix ? 1 : 0));
+        out.append(link.substr(shared));
+        previous = link;
+    }
+}
+
+static bool decodeLinks(std::string_view encoded, std::string& out)
+{
+    constexpr std::string_view wikiPrefix = "/wiki/";
+    out.clear();
+
+    std::string previous;
+    std::uint64_t shared = 0;
+    std::uint64_t suffixAndFlag = 0;
+    while (!encoded.empty())
+    {
+        if (!readVarint(encoded, shared) || !readVarint(encoded, suffixAndFlag))
+        {
+            return false;
+        }
+
+        const std::uint64_t suffixSize = suffixAndFlag >> 1;
+        if (shared > previous.size() || suffixSize > encoded.size())
+        {
+            return false;
+        }
+
+        previous.resize(shared);
+        previous.append(encoded.substr(0, suffixSize));
+        encoded.remove_prefix(suffixSize);
+
+        if ((suffixAndFlag & 1) != 0)
+        {
+            out += wikiPrefix;
+        }
+        out += previous;
+        out += '\n';
+    }
+    return true;
+}
+
+struct CompressedPage
+{
+    std::string name;
+    std::uint8_t flags{};
+    std::uint64_t rawSize{};
+    std::string payload;
+};
+
+// Appends records to rolling segment files. Single writer.
+class PageArchiveWriter
+{
+public:
+    static constexpr std::uint64_t SegmentSize = 256ULL << 20;
+
+    explicit PageArchiveWriter(std::string folder)
+        : m_folder(std::move(folder))
+    {
+    }
+
+    bool write(const CompressedPage& page)
+    {
+        if (!m_stream.is_open() || m_segmentBytes >= SegmentSize)
+        {
+            if (!openNextSegment())
+            {
+                return false;
+            }
+        }
+
+        m_record.clear();
+        writeVarint(m_record, page.name.size());
+        m_record += page.name;
+        m_record += static_cast<char>(page.flags);
+        writeVarint(m_record, page.rawSize);
+        writeVarint(m_record, page.payload.size());
+        m_stream.write(m_record.data(), m_record.size());
+        m_stream.write(page.payload.data(), page.payload.size());
+        m_segmentBytes += m_record.size() + page.payload.size();
+        return static_cast<bool>(m_stream);
+    }
+
+private:
+    bool openNextSegment()
+    {
+        std::ostringstream name;
+        name << "pages-" << std::setw(6) << std::setfill('0') << m_segmentCount++ << ".wpz";
+        const auto path = std::filesystem::path(m_folder) / name.str();
+
+        m_stream.close();
+        m_stream.open(path, std::ios::binary);
+        if (!m_stream)
+        {
+            std::cerr << "Can't create file " << path << std::endl;
+            return false;
+        }
+        m_stream.write(ArchiveMagic.data(), ArchiveMagic.size());
+        m_segmentBytes = ArchiveMagic.size();
+        return true;
+    }
+
+    std::string m_folder;
+    std::ofstream m_stream;
+    std::string m_record;
+    std::uint64_t m_segmentBytes = 0;
+    std::uint32_t m_segmentCount = 0;
+};
+
+// Reads the records of one segment file in order
+class PageArchiveReader
+{
+public:
+    explicit PageArchiveReader(const std::filesystem::path& path)
+        : m_stream(path, std::ios::binary)
+    {
+        std::string magic(ArchiveMagic.size(), '\0');
+        m_stream.read(magic.data(), magic.size());
+        m_valid = m_stream && magic == ArchiveMagic;
+    }
+
+    bool valid() const { return m_valid; }
+
+    // False at the end of the segment, or if it is truncated
+    bool next(CompressedPage& page)
+    {
+        std::uint64_t nameSize = 0;
+        std::uint64_t payloadSize = 0;
+        if (!m_valid || !readVarint(m_stream, nameSize))
+        {
+            return false;
+        }
+
+        page.name.resize(nameSize);
+        m_stream.read(page.name.data(), nameSize);
+        page.flags = static_cast<std::uint8_t>(m_stream.get());
+        if (!readVarint(m_stream, page.rawSize) || !readVarint(m_stream, payloadSize))
+        {
+            return false;
+        }
+
+        page.payload.resize(payloadSize);
+        m_stream.read(page.payload.data(), payloadSize);
+        return static_cast<bool>(m_stream);
+    }
+
+private:
+    std::ifstream m_stream;
+    bool m_valid = false;
+};
+
+struct CompressionStats
+{
+    std::atomic<std::uint64_t> rawBytes{};
+    std::atomic<std::uint64_t> compressedBytes{};
+    std::atomic<std::uint64_t> compressNs{};
+};
+
+#ifdef WIKIPEDIA_PARSER_HAS_ZSTD
+
+// Shared by the compressing stages. Pages are compressed without a dictionary while a sample of them is
+// collected; the dictionary is then trained on a separate thread so the pipeline never waits for it.
+class PageCompressor
+{
+public:
+    static constexpr std::size_t SampleBytes = 8 << 20;
+    static constexpr std::size_t SampleCount = 20000;
+    static constexpr std::size_t DictionarySize = 112640;
+
+    PageCompressor(std::string dictionaryFolder, int level)
+        : m_dictionaryPath(std::filesystem::path(dictionaryFolder) / DictionaryFileName)
+        , m_level(level)
+    {
+    }
+
+    ~PageCompressor()
+    {
+        if (m_trainingThread.joinable())
+        {
+            m_trainingThread.join();
+        }
+        ZSTD_freeCDict(m_dictionary.load());
+    }
+
+    PageCompressor(const PageCompressor&) = delete;
+    PageCompressor& operator=(const PageCompressor&) = delete;
+
+    // cctx belongs to the caller so that concurrent stages don't share one
+    bool compress(ZSTD_CCtx* cctx, std::string_view encoded, CompressedPage& page)
+    {
+        const ZSTD_CDict* dictionary = m_dictionary.load(std::memory_order_acquire);
+        if (dictionary == nullptr)
+        {
+            addSample(encoded);
+        }
+
+        page.payload.resize(ZSTD_compressBound(encoded.size()));
+        const std::size_t size =
+            dictionary != nullptr
+                ? ZSTD_compress_usingCDict(cctx, page.payload.data(), page.payload.size(), encoded.data(), encoded.size(), dictionary)
+                : ZSTD_compressCCtx(cctx, page.payload.data(), page.payload.size(), encoded.data(), encoded.size(), m_level);
+        if (ZSTD_isError(size))
+        {
+            std::cerr << "Compression failed: " << ZSTD_getErrorName(size) << std::endl;
+            return false;
+        }
+
+        page.payload.resize(size);
+        page.flags = dictionary != nullptr ? RecordUsesDictionary : 0;
+        return true;
+    }
+
+    bool hasDictionary() const { return m_dictionary.load(std::memory_order_relaxed) != nullptr; }
+
+private:
+    void addSample(std::string_view encoded)
+    {
+        std::lock_guard<std::mutex> guard(m_sampleMutex);
+        if (m_trainingStarted)
+        {
+            return;
+        }
+
+        m_samples.append(encoded);
+        m_sampleSizes.push_back(encoded.size());
+        if (m_samples.size() >= SampleBytes || m_sampleSizes.size() >= SampleCount)
+        {
+            m_trainingStarted = true;
+            m_trainingThread = std::thread(&PageCompressor::train, this);
+        }
+    }
+
+    void train()
+    {
+        std::string dictionary(DictionarySize, '\0');
+        const std::size_t size =
+            ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), m_samples.data(), m_sampleSizes.data(), m_sampleSizes.size());
+        m_samples = {};
+        m_sampleSizes = {};
+        if (ZDICT_isError(size))
+        {
+            std::cerr << "Couldn't train dictionary: " << ZDICT_getErrorName(size) << ", compressing without one" << std::endl;
+            return;
+        }
+        dictionary.resize(size);
+
+        // The file has to be there before the first record that needs it
+        {
+            std::ofstream stream(m_dictionaryPath, std::ios::binary);
+            stream.write(dictionary.data(), dictionary.size());
+            if (!stream)
+            {
+                std::cerr << "Couldn't write dictionary " << m_dictionaryPath << ", compressing without one" << std::endl;
+                return;
+            }
+        }
+
+        m_dictionary.store(ZSTD_createCDict(dictionary.data(), dictionary.size(), m_level), std::memory_order_release);
+        std::cout << "Trained a " << size << " bytes dictionary for page compression\n";
+    }
+
+    std::string m_dictionaryPath;
+    int m_level;
+
+    std::mutex m_sampleMutex;
+    bool m_trainingStarted = false;
+    std::string m_samples;
+    std::vector<std::size_t> m_sampleSizes;
+    std::thread m_trainingThread;
+
+    std::atomic<ZSTD_CDict*> m_dictionary = nullptr;
+};
+
+#endif
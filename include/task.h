@@ -0,0 +1,117 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <stop_token>
+#include <utility>
+#include "executor.h"
+
+class TaskScope;
+
+// A pipeline stage. Created suspended, started by TaskScope::spawn, destroys itself when it returns.
+class Task
+{
+public:
+    struct promise_type
+    {
+        TaskScope* scope = nullptr;
+
+        Task get_return_object() { return Task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+            void await_resume() const noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+
+        void unhandled_exception()
+        {
+            std::cerr << "Unhandled exception in pipeline stage" << std::endl;
+            std::abort();
+        }
+    };
+
+    Task(Task&& other) noexcept
+        : m_handle(std::exchange(other.m_handle, nullptr))
+    {
+    }
+
+    ~Task()
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+        }
+    }
+
+private:
+    friend class TaskScope;
+
+    explicit Task(std::coroutine_handle<promise_type> handle)
+        : m_handle(handle)
+    {
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+// Owns the stages of the pipeline. Whenever one stage returns, the whole scope is cancelled, which closes
+// every channel tied to stopToken(), so the other stages drain and return as well.
+class TaskScope
+{
+public:
+    void spawn(Executor& executor, Task task)
+    {
+        auto handle = std::exchange(task.m_handle, nullptr);
+        handle.promise().scope = this;
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_running++;
+        }
+        executor.schedule(handle);
+    }
+
+    void cancel() { m_stopSource.request_stop(); }
+
+    std::stop_token stopToken() const { return m_stopSource.get_token(); }
+
+    // Blocks until every spawned task has returned
+    void wait()
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        m_done.wait(guard, [this] { return m_running == 0; });
+    }
+
+private:
+    friend struct Task::promise_type::FinalAwaiter;
+
+    void taskDone()
+    {
+        cancel();
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_running--;
+        m_done.notify_all();
+    }
+
+    std::stop_source m_stopSource;
+    std::mutex m_mutex;
+    std::condition_variable m_done;
+    std::size_t m_running = 0;
+};
+
+inline void Task::promise_type::FinalAwaiter::await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+{
+    TaskScope* scope = handle.promise().scope;
+    handle.destroy();
+    scope->taskDone();
+}
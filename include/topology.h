@@ -0,0 +1,150 @@
+#pragma once
+
+// Machine topology for the NUMA aware placement (--numa). Nodes are read from sysfs directly, there is no
+// libnuma dependency. Memory locality comes from Linux's first touch policy: a thread pinned to a node's cores
+// allocates (lexbor documents, page buffers) on that node.
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct NumaNode
+{
+    unsigned id;
+    std::vector<unsigned> cpus;
+};
+
+// What runs where on one node: its parsers get cores of their own, fetchers and the other stages share the rest
+struct NodePlacement
+{
+    unsigned node;
+    std::vector<unsigned> parserCpus;
+    std::vector<unsigned> serviceCpus;
+};
+
+// "0-3,8-11" -> 0 1 2 3 8 9 10 11
+static std::vector<unsigned> parseCpuList(std::string_view list)
+{
+    std::vector<unsigned> cpus;
+    while (!list.empty())
+    {
+        const std::size_t commaPos = list.find(',');
+        const std::string_view range = list.substr(0, commaPos);
+        list.remove_prefix(commaPos == std::string_view::npos ? list.size() : commaPos + 1);
+
+        unsigned first = 0;
+        const auto [end, error] = std::from_chars(range.data(), range.data() + range.size(), first);
+        if (error != std::errc())
+        {
+            continue;
+        }
+        unsigned last = first;
+        if (end != range.data() + range.size() && *end == '-')
+        {
+            std::from_chars(end + 1, range.data() + range.size(), last);
+        }
+        for (auto cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// Only the cores this process may run on (taskset, cgroups) are kept. Empty if sysfs has no node information.
+static std::vector<NumaNode> readNumaNodes()
+{
+    std::vector<NumaNode> nodes;
+    std::error_code error;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    const bool hasAffinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error))
+    {
+        const std::string name = entry.path().filename();
+        if (!name.starts_with("node") || name.size() == 4 || !std::all_of(name.begin() + 4, name.end(), ::isdigit))
+        {
+            continue;
+        }
+
+        std::ifstream stream(entry.path() / "cpulist");
+        std::string cpuList;
+        std::getline(stream, cpuList);
+
+        NumaNode node{static_cast<unsigned>(std::stoul(name.substr(4))), {}};
+        for (const auto cpu : parseCpuList(cpuList))
+        {
+            if (!hasAffinity || CPU_ISSET(cpu, &allowed))
+            {
+                node.cpus.push_back(cpu);
+            }
+        }
+        // Memory only nodes have nothing to run
+        if (!node.cpus.empty())
+        {
+            nodes.push_back(std::move(node));
+        }
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+    return nodes;
+}
+
+// Empty on a single node machine, where there is nothing to place
+static std::vector<NodePlacement> planPlacement(const std::vector<NumaNode>& nodes, std::size_t serviceCoresPerNode)
+{
+    std::vector<NodePlacement> placement;
+    if (nodes.size() < 2)
+    {
+        return placement;
+    }
+
+    for (const auto& node : nodes)
+    {
+        // Parsers keep at least one core, even if that means sharing it
+        const std::size_t serviceCount = std::clamp<std::size_t>(serviceCoresPerNode, 1, node.cpus.size());
+        NodePlacement nodePlacement{node.id, {}, {}};
+        nodePlacement.serviceCpus.assign(node.cpus.begin(), node.cpus.begin() + serviceCount);
+        nodePlacement.parserCpus.assign(node.cpus.begin() + serviceCount, node.cpus.end());
+        if (nodePlacement.parserCpus.empty())
+        {
+            nodePlacement.parserCpus = nodePlacement.serviceCpus;
+        }
+        placement.push_back(std::move(nodePlacement));
+    }
+    return placement;
+}
+
+static std::vector<unsigned> serviceCpus(const std::vector<NodePlacement>& placement)
+{
+    std::vector<unsigned> cpus;
+    for (const auto& node : placement)
+    {
+        cpus.insert(cpus.end(), node.serviceCpus.begin(), node.serviceCpus.end());
+    }
+    return cpus;
+}
+
+// Does nothing with an empty list
+static bool pinCurrentThread(const std::vector<unsigned>& cpus)
+{
+    if (cpus.empty())
+    {
+        return true;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const auto cpu : cpus)
+    {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
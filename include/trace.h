@@ -0,0 +1,336 @@
+#pragma once
+
+// Per-page lifecycle tracing, exported as Chrome trace / Perfetto JSON.
+// Hooks compile to nothing unless built with WIKIPEDIA_PARSER_TRACING; when compiled in, they still do nothing
+// until Tracer::enable() is called (--trace=<file>).
+
+#ifdef WIKIPEDIA_PARSER_TRACING
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+struct TraceEvent
+{
+    // Points to a string literal
+    const char* stage;
+    std::uint64_t pageId;
+    std::uint64_t startNs;
+    std::uint64_t durationNs;
+    char page[48];
+
+    TraceEvent() = default;
+
+    TraceEvent(const char* stageName, std::string_view pageName, std::uint64_t start)
+        : stage(stageName)
+        , pageId(std::hash<std::string_view>{}(pageName))
+        , startNs(start)
+        , durationNs(0)
+    {
+        const std::size_t length = std::min(pageName.size(), sizeof(page) - 1);
+        std::memcpy(page, pageName.data(), length);
+        page[length] = '\0';
+    }
+};
+
+// Single writer (its thread), read concurrently by the dump. The oldest events get overwritten.
+// Every slot is a small seqlock: the writer makes its sequence odd while it writes the event, and sets it to the
+// even value of that write once done, so the dump can tell a slot it read cleanly from one being rewritten under it.
+class TraceBuffer
+{
+public:
+    static constexpr std::size_t Capacity = 1 << 15;
+
+    explicit TraceBuffer(std::uint32_t threadId)
+        : m_threadId(threadId)
+    {
+    }
+
+    void record(const TraceEvent& event)
+    {
+        const std::uint64_t index = m_written.load(std::memory_order_relaxed);
+        Slot& slot = m_slots[index % Capacity];
+
+        std::array<std::uint64_t, Slot::WordCount> words;
+        std::memcpy(words.data(), &event, sizeof(TraceEvent));
+
+        slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (auto i = 0UL; i < Slot::WordCount; i++)
+        {
+            slot.words[i].store(words[i], std::memory_order_relaxed);
+        }
+        slot.sequence.store(index * 2 + 2, std::memory_order_release);
+        m_written.store(index + 1, std::memory_order_release);
+    }
+
+    // Copies the events still in the buffer, skipping any the writer overwrote while they were read
+    std::vector<TraceEvent> snapshot() const
+    {
+        const std::uint64_t written = m_written.load(std::memory_order_acquire);
+        const std::uint64_t first = written > Capacity ? written - Capacity : 0;
+
+        std::vector<TraceEvent> events;
+        events.reserve(written - first);
+        std::array<std::uint64_t, Slot::WordCount> words;
+        for (auto i = first; i < written; i++)
+        {
+            const Slot& slot = m_slots[i % Capacity];
+            const std::uint64_t expected = i * 2 + 2;
+            if (slot.sequence.load(std::memory_order_acquire) != expected)
+            {
+                continue;
+            }
+            for (auto word = 0UL; word < Slot::WordCount; word++)
+            {
+                words[word] = slot.words[word].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != expected)
+            {
+                continue;
+            }
+
+            TraceEvent& event = events.emplace_back();
+            std::memcpy(&event, words.data(), sizeof(TraceEvent));
+        }
+        return events;
+    }
+
+    std::uint32_t threadId() const { return m_threadId; }
+
+    std::uint64_t written() const { return m_written.load(std::memory_order_relaxed); }
+
+private:
+    static_assert(std::is_trivially_copyable_v<TraceEvent> && sizeof(TraceEvent) % sizeof(std::uint64_t) == 0);
+
+    struct Slot
+    {
+        static constexpr std::size_t WordCount = sizeof(TraceEvent) / sizeof(std::uint64_t);
+
+        std::atomic<std::uint64_t> sequence{};
+        std::array<std::atomic<std::uint64_t>, WordCount> words{};
+    };
+
+    std::uint32_t m_threadId;
+    std::atomic<std::uint64_t> m_written{};
+    std::array<Slot, Capacity> m_slots{};
+};
+
+class Tracer
+{
+public:
+    static void enable(std::string outputPath)
+    {
+        instance().m_outputPath = std::move(outputPath);
+        instance().m_spanCostNs = measureSpanCost();
+        instance().m_enabled.store(true, std::memory_order_relaxed);
+    }
+
+    static bool enabled() { return instance().m_enabled.load(std::memory_order_relaxed); }
+
+    // Events recorded so far by every thread, with spanCostNs() this gives the time spent tracing
+    static std::uint64_t recordedEvents()
+    {
+        auto& tracer = instance();
+        std::lock_guard<std::mutex> guard(tracer.m_mutex);
+        std::uint64_t events = 0;
+        for (const auto& buffer : tracer.m_buffers)
+        {
+            events += buffer->written();
+        }
+        return events;
+    }
+
+    // What one span costs its thread, measured once when tracing gets enabled
+    static double spanCostNs() { return instance().m_spanCostNs; }
+
+    static std::uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - instance().m_start).count();
+    }
+
+    // Not inlined on purpose: a coroutine may resume on another thread, and the compiler is allowed to
+    // keep a thread_local's address across a co_await in the same function
+    [[gnu::noinline]] static TraceBuffer& threadBuffer()
+    {
+        thread_local TraceBuffer* buffer = instance().registerThread();
+        return *buffer;
+    }
+
+    // Async-signal-safe: the actual dump happens on the next dumpIfRequested()
+    static void requestDump() { instance().m_dumpRequested.store(true, std::memory_order_relaxed); }
+
+    static void dumpIfRequested()
+    {
+        if (instance().m_dumpRequested.exchange(false, std::memory_order_relaxed))
+        {
+            dump();
+        }
+    }
+
+    static void dump()
+    {
+        auto& tracer = instance();
+        if (!enabled())
+        {
+            return;
+        }
+
+        std::vector<std::pair<std::uint32_t, std::vector<TraceEvent>>> threads;
+        {
+            std::lock_guard<std::mutex> guard(tracer.m_mutex);
+            for (const auto& buffer : tracer.m_buffers)
+            {
+                threads.emplace_back(buffer->threadId(), buffer->snapshot());
+            }
+        }
+
+        std::ofstream stream(tracer.m_outputPath);
+        if (!stream)
+        {
+            std::cerr << "Couldn't create trace file " << tracer.m_outputPath << std::endl;
+            return;
+        }
+
+        // Every stage shows up on the thread that ran it ("X"), and on a per-page async track ("b"/"e"),
+        // where the gaps between stages are the time the page spent waiting in queues
+        stream << std::fixed << std::setprecision(3);
+        stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        std::size_t eventCount = 0;
+        for (const auto& [threadId, events] : threads)
+        {
+            for (const auto& event : events)
+            {
+                const double startUs = event.startNs / 1000.0;
+                const double durationUs = event.durationNs / 1000.0;
+                stream << (first ? "" : ",") << "\n{\"name\":\"" << event.stage << "\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                       << threadId << ",\"ts\":" << startUs << ",\"dur\":" << durationUs << ",\"args\":{\"page\":\"";
+                writeEscaped(stream, event.page);
+                stream << "\"}}";
+                for (const char* phase : {"b", "e"})
+                {
+                    stream << ",\n{\"name\":\"" << event.stage << "\",\"cat\":\"page\",\"ph\":\"" << phase << "\",\"pid\":1,\"id\":\"0x"
+                           << std::hex << event.pageId << std::dec
+                           << "\",\"ts\":" << (phase[0] == 'b' ? startUs : startUs + durationUs) << '}';
+                }
+                first = false;
+                eventCount++;
+            }
+        }
+        stream << "\n]}\n";
+        std::cout << "Wrote " << eventCount << " trace events to " << tracer.m_outputPath << '\n';
+    }
+
+private:
+    static Tracer& instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // Times what a TraceSpan does (two clock reads, building the event, recording it) into a scratch buffer
+    static double measureSpanCost()
+    {
+        constexpr std::size_t spanCount = 1 << 17;
+        auto buffer = std::make_unique<TraceBuffer>(0);
+        const std::string page = "en.wikipedia.org/wiki/Calibration";
+
+        const std::uint64_t start = now();
+        for (auto i = 0UL; i < spanCount; i++)
+        {
+            TraceEvent event("calibration", page, now());
+            event.durationNs = now() - event.startNs;
+            buffer->record(event);
+        }
+        return static_cast<double>(now() - start) / spanCount;
+    }
+
+    TraceBuffer* registerThread()
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        // Buffers outlive their thread so a dump still shows threads that are gone
+        m_buffers.push_back(std::make_unique<TraceBuffer>(static_cast<std::uint32_t>(m_buffers.size() + 1)));
+        return m_buffers.back().get();
+    }
+
+    static void writeEscaped(std::ostream& stream, const char* text)
+    {
+        for (; *text != '\0'; text++)
+        {
+            if (*text == '"' || *text == '\\')
+            {
+                stream << '\\';
+            }
+            if (static_cast<unsigned char>(*text) >= 0x20)
+            {
+                stream << *text;
+            }
+        }
+    }
+
+    std::atomic<bool> m_enabled = false;
+    std::atomic<bool> m_dumpRequested = false;
+    std::string m_outputPath;
+    double m_spanCostNs = 0;
+    std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> m_buffers;
+};
+
+// Records [construction, destruction) as one event of the given stage for page. The page name is copied
+// up front, so it can change or go away before the span ends.
+class TraceSpan
+{
+public:
+    TraceSpan(const char* stage, std::string_view page)
+        : m_enabled(Tracer::enabled())
+    {
+        if (m_enabled)
+        {
+            m_event = TraceEvent(stage, page, Tracer::now());
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (m_enabled)
+        {
+            m_event.durationNs = Tracer::now() - m_event.startNs;
+            Tracer::threadBuffer().record(m_event);
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    bool m_enabled;
+    TraceEvent m_event;
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+// Traces the rest of the enclosing scope
+#define TRACE_SPAN(stage, page) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(stage, page)
+
+#else
+
+#define TRACE_SPAN(stage, page)
+
+#endif
@@ -1,121 +1,105 @@
 #include <algorithm>
+#include <bit>
 #include <cmath>
+#include <ctime>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <signal.h>
 #include <sstream>
 #include <string>
-#include <unordered_set>
+#include <unordered_map>
 #include <curl/curl.h>
 #include <lexbor/dom/collection.h>
 #include <lexbor/dom/dom.h>
 #include <lexbor/html/parser.h>
+#include "async_channel.h"
+#include "curl_reactor.h"
+#include "executor.h"
+#include "fetch_stats.h"
+#include "frontier.h"
+#include "host_scheduler.h"
 #include "init_curl.h"
-#include "thread_safe_queue.h"
-
-using LinksToCurlThrottleQueue = ThreadSafeQueueFixedSize<std::string, 256>;
-using LinksToCurlQueue = ThreadSafeQueueFixedSize<std::string, 256>;
-using HtmlToParseQueue = ThreadSafeQueueFixedSize<std::pair<std::string, std::string>, 256>;
-using LinksToFilterQueue = ThreadSafeQueueFixedSize<std::string, 512>;
-using LinksToDispatchQueue = ThreadSafeQueueFixedSize<std::string, 256>;
-using LinksToSerializeQueue = ThreadSafeQueueFixedSize<std::string, 1024>;
-using PagesToSerializeQueue = ThreadSafeQueueFixedSize<std::pair<std::string, std::string>, 256>;
+#include "link_extraction.h"
+#include "options.h"
+#include "page_archive.h"
+#include "task.h"
+#include "topology.h"
+#include "trace.h"
+
+using HtmlToParseQueue = AsyncChannel<std::pair<FrontierLink, std::string>, 256>;
+// One per NUMA node with --numa, a single one otherwise
+using HtmlToParseQueues = std::vector<std::unique_ptr<HtmlToParseQueue>>;
+using LinksToFilterQueue = AsyncChannel<FrontierLink, 512>;
+using LinksToDispatchQueue = AsyncChannel<FrontierLink, 256>;
+using LinksToSerializeQueue = AsyncChannel<FrontierLink, 1024>;
+using PagesToSerializeQueue = AsyncChannel<std::pair<std::string, std::string>, 256>;
+using CompressedPagesQueue = AsyncChannel<CompressedPage, 256>;
+// Tier the deserializer should read back
+using RefillRequestQueue = AsyncChannel<std::size_t, 1>;
 
 std::atomic<bool> shouldStop{false};
 
-void fetchPages(LinksToCurlQueue& inQueue, HtmlToParseQueue& outQueue, std::atomic<std::uint64_t>& throttleQuantity)
+// Fetchers take their links straight from the scheduler, so a link is only handed out once its host allows the fetch.
+// The page is copied out of curl's buffer on the fetcher's thread, so with --numa it lands on homeNode's memory, next to
+// the parsers it is handed to.
+Task fetchPages(HostScheduler& scheduler, HtmlToParseQueues& outQueues, std::size_t homeNode, CurlShare& share, CurlReactor& reactor,
+                FetchStats& fetchStats)
 {
-    auto [curl, responseString] = initCurl();
-    std::string toFetch;
+    auto [curl, responseString] = initCurl(share.get());
+    FrontierLink toFetch;
 
     while (true)
     {
-        if (inQueue.pop(toFetch))
+        if (co_await scheduler.next(toFetch))
         {
-            outQueue.quit();
-            std::cout << "Terminating fetch" << std::endl;
             break;
         }
 
         responseString->clear();
-        curl_easy_setopt(curl, CURLOPT_URL, std::string("https://en.wikipedia.org" + toFetch).c_str());
-        curl_easy_perform(curl);
-        auto end = std::chrono::high_resolution_clock::now();
-        if (outQueue.push({toFetch, *responseString}))
+        curl_easy_setopt(curl, CURLOPT_URL, std::string("https://" + toFetch.link).c_str());
         {
-            inQueue.quit();
-            std::cout << "Terminating fetch" << std::endl;
-            break;
+            TRACE_SPAN("fetch", toFetch.link);
+            fetchStats.record(curl, co_await reactor.perform(curl));
         }
-    }
-    curl_easy_cleanup(curl);
-}
 
-void throttleFetch(std::chrono::microseconds durationToWaitBetweenSends, std::uint32_t sendCount, LinksToCurlThrottleQueue& inQueue,
-                   LinksToCurlQueue& outQueue)
-{
-    if (durationToWaitBetweenSends.count() == 0.0)
-    {
-        std::string link;
-        while (true)
+        // Same node parsers first, another node's only if all of those are busy
+        std::pair<FrontierLink, std::string> fetched{toFetch, *responseString};
+        bool handedOff = false;
+        for (auto offset = 0UL; offset < outQueues.size() && !handedOff; offset++)
         {
-            if (inQueue.pop(link))
-            {
-                outQueue.quit();
-                break;
-            }
-
-            if (outQueue.push(link))
-            {
-                inQueue.quit();
-                break;
-            }
+            handedOff = outQueues[(homeNode + offset) % outQueues.size()]->tryPush(std::move(fetched));
         }
-        return;
-    }
-
-    auto timestamp = std::chrono::high_resolution_clock::now();
-    auto timeToSleepTotal = std::chrono::microseconds(0);
-    std::string link;
-
-    while (true)
-    {
-        if (inQueue.pop(link))
-        {
-            outQueue.quit();
-            break;
-        }
-
-        if (outQueue.push(link))
+        if (!handedOff && co_await outQueues[homeNode]->push(std::move(fetched)))
         {
-            inQueue.quit();
             break;
         }
+    }
+    std::cout << "Terminating fetch" << std::endl;
+    curl_easy_cleanup(curl);
+}
 
-        auto now = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(now - timestamp);
-        auto timeToSleepThisLoop = std::chrono::duration_cast<std::chrono::microseconds>(durationToWaitBetweenSends - duration);
-
-        timeToSleepTotal += timeToSleepThisLoop;
-        if (timeToSleepTotal.count() < -1000)
-        {
-            timeToSleepTotal = std::chrono::microseconds(-1000);
-        }
-        timestamp = now;
-
-        if (timeToSleepTotal.count() > 0)
-        {
-            std::this_thread::sleep_for(timeToSleepTotal);
-        }
+// A HEAD request through the reactor, so the connection it opens stays in the reactor's pool for the fetchers
+Task warmUpConnection(CurlReactor& reactor, CurlShare& share, std::string url, std::atomic<std::size_t>& connected)
+{
+    auto [curl, responseString] = initCurl(share.get());
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    if (co_await reactor.perform(curl) == CURLE_OK)
+    {
+        connected++;
     }
+    curl_easy_cleanup(curl);
 }
 
-void parseHtml(HtmlToParseQueue& inQueue, LinksToFilterQueue& outQueue, PagesToSerializeQueue& pagesQueue,
-               std::atomic<std::uint64_t>& throttleQuantity, std::uint8_t numberOfCurlThreads)
+Task parseHtml(HtmlToParseQueue& inQueue, LinksToFilterQueue& outQueue, PagesToSerializeQueue& pagesQueue, HostScheduler& scheduler,
+               const LinkExtractionPolicy& linkPolicy,
+               std::atomic<std::uint32_t>& extractedLinksCount, std::atomic<std::uint32_t>& emittedLinksCount,
+               std::atomic<std::uint32_t>& parsedPagesCount)
 {
-    std::pair<std::string, std::string> fetchedData;
+    std::pair<FrontierLink, std::string> fetchedData;
     std::string links;
+    std::vector<FrontierLink> children;
 
     auto document = lxb_html_document_create();
     auto collection = lxb_dom_collection_make(lxb_dom_interface_document(document), 128);
@@ -124,299 +108,381 @@ void parseHtml(HtmlToParseQueue& inQueue, LinksToFilterQueue& outQueue, PagesToS
         lxb_dom_collection_clean(collection);
         lxb_html_document_clean(document);
 
-        if (inQueue.pop(fetchedData))
+        if (co_await inQueue.pop(fetchedData))
         {
-            outQueue.quit();
-            pagesQueue.quit();
-            std::cout << "Terminating parse" << std::endl;
             break;
         }
-        const auto& [pageName, responseString] = fetchedData;
-
-        auto status = lxb_html_document_parse(document, (const unsigned char*)responseString.c_str(), responseString.size());
+        const auto& [page, responseString] = fetchedData;
+        const auto& pageName = page.link;
 
-        if (status != LXB_STATUS_OK)
+        // Parsing and extraction only, waiting on the next stages is traced on its own below
         {
-            std::cerr << "Error while parsing HTML" << std::endl;
-            continue;
-        }
+            TRACE_SPAN("parse", pageName);
+            auto status = lxb_html_document_parse(document, (const unsigned char*)responseString.c_str(), responseString.size());
 
-        auto body = lxb_dom_interface_element(document->body);
+            if (status != LXB_STATUS_OK)
+            {
+                std::cerr << "Error while parsing HTML" << std::endl;
+                continue;
+            }
 
-        // Check if page is error
-        std::size_t titleLen;
-        const char* title = (const char*)lxb_html_document_title_raw(document, &titleLen);
-        if (title != nullptr)
-        {
-            if (std::string_view(title, titleLen) == "Wikimedia Error")
+            auto body = lxb_dom_interface_element(document->body);
+
+            // Check if page is error
+            std::size_t titleLen;
+            const char* title = (const char*)lxb_html_document_title_raw(document, &titleLen);
+            if (title != nullptr)
             {
-                // WE ARE GETTING THROTTLED
-                std::cout << "GETTING THROTTLED!!!\n";
-                throttleQuantity += numberOfCurlThreads * 4;
-                // Put back the link in the queue to re fetch later
-                outQueue.push(pageName);
+                if (std::string_view(title, titleLen) == "Wikimedia Error")
+                {
+                    // WE ARE GETTING THROTTLED
+                    std::cout << "GETTING THROTTLED by " << hostOf(pageName) << "!!!\n";
+                    // Back off from that host only, and fetch the page again later
+                    scheduler.retryLater(page);
+                    continue;
+                }
+            }
+
+            // Restrict the search to the article itself if asked to
+            auto root = body;
+            if (linkPolicy.contentOnly)
+            {
+                if (auto contentRoot = findContentRoot(body, collection); contentRoot != nullptr)
+                {
+                    root = contentRoot;
+                }
+                lxb_dom_collection_clean(collection);
+            }
+
+            // Parse page
+            status = lxb_dom_elements_by_attr_begin(root, collection, (const lxb_char_t*)"href", 4, (const lxb_char_t*)"/wiki", 5, true);
+            if (status != LXB_STATUS_OK)
+            {
+                std::cerr << "Error while parsing HTML" << std::endl;
                 continue;
             }
-        }
 
-        // Parse page
-        status = lxb_dom_elements_by_attr_begin(body, collection, (const lxb_char_t*)"href", 4, (const lxb_char_t*)"/wiki", 5, true);
-        if (status != LXB_STATUS_OK)
-        {
-            std::cerr << "Error while parsing HTML" << std::endl;
-            continue;
+            links.clear();
+            children.clear();
+            const std::size_t linkCount = lxb_dom_collection_length(collection);
+            for (size_t i = 0; i < linkCount; i++)
+            {
+                auto element = lxb_dom_collection_element(collection, i);
+                const char* link =
+                    (const char*)lxb_dom_element_get_attribute(element, reinterpret_cast<const unsigned char*>("href"), 4, nullptr);
+
+                if (!linkPolicy.isAllowed(link) || (linkPolicy.skipNavigationBoxes && isInSkippedContainer(element, root)))
+                {
+                    continue;
+                }
+
+                // Hrefs are relative to the page's host
+                children.push_back(FrontierLink{std::string(hostOf(pageName)) + link, static_cast<std::uint16_t>(page.depth + 1)});
+                links += link;
+                links += '\n';
+            }
+            extractedLinksCount.fetch_add(linkCount, std::memory_order_relaxed);
+            emittedLinksCount.fetch_add(children.size(), std::memory_order_relaxed);
         }
 
-        links.clear();
+        TRACE_SPAN("parse:handoff", pageName);
         bool quit = false;
-        for (size_t i = 0; i < lxb_dom_collection_length(collection); i++)
+        for (auto& child : children)
         {
-            auto element = lxb_dom_collection_element(collection, i);
-            const char* link =
-                (const char*)lxb_dom_element_get_attribute(element, reinterpret_cast<const unsigned char*>("href"), 4, nullptr);
-            if (outQueue.push(std::string((const char*)link)))
+            if (co_await outQueue.push(std::move(child)))
             {
                 quit = true;
                 break;
             }
-
-            links += link;
-            links += '\n';
-        }
-
-        if (quit)
-        {
-            inQueue.quit();
-            pagesQueue.quit();
-            std::cout << "Terminating parse" << std::endl;
-            break;
         }
 
-        if (pagesQueue.push({pageName, links}))
+        if (quit || co_await pagesQueue.push({pageName, links}))
         {
-            inQueue.quit();
-            outQueue.quit();
-            std::cout << "Terminating parse" << std::endl;
             break;
         }
+        parsedPagesCount.fetch_add(1, std::memory_order_relaxed);
     }
+    std::cout << "Terminating parse" << std::endl;
     lxb_dom_collection_destroy(collection, true);
     lxb_html_document_destroy(document);
 }
 
-void filterLinks(LinksToFilterQueue& inQueue, LinksToDispatchQueue& outQueue, LinksToCurlThrottleQueue& curlQueue,
-                 std::condition_variable& deserializeCondition, std::vector<std::string>& disallowedLinks,
+Task filterLinks(LinksToFilterQueue& inQueue, LinksToDispatchQueue& outQueue, const std::vector<std::string>& disallowedLinks,
                  std::atomic<std::uint32_t>& goodLinksCount, std::atomic<std::uint32_t>& visitedLinksCount)
 {
-    std::unordered_set<std::string> visited{};
-    std::string toFilter;
-    std::size_t totalMs;
-
-    disallowedLinks.push_back("/wiki/Category:");
-    disallowedLinks.push_back("/wiki/File:");
-    disallowedLinks.push_back("/wiki/Wikipedia:");
+    // Link -> number of times we saw it, which is what the frontier orders on
+    std::unordered_map<std::string, std::uint32_t> visited{};
+    FrontierLink toFilter;
 
     while (true)
     {
-        const float fullness = static_cast<float>(curlQueue.size()) / curlQueue.capacity();
-        if (fullness < 0.5f)
+        if (co_await inQueue.pop(toFilter))
         {
-            deserializeCondition.notify_one();
-        }
-
-        if (inQueue.pop(toFilter))
-        {
-            outQueue.quit();
-            std::cout << "Terminating filter" << std::endl;
             break;
         }
 
-        std::size_t hashtagPos = toFilter.find("#");
-        if (hashtagPos != std::string::npos)
+        // The lookup itself, waiting on dispatch is traced on its own
+        bool forward = false;
         {
-            toFilter.resize(hashtagPos);
+            TRACE_SPAN("filter", toFilter.link);
+            auto& link = toFilter.link;
+            std::size_t hashtagPos = link.find("#");
+            if (hashtagPos != std::string::npos)
+            {
+                link.resize(hashtagPos);
+            }
+
+            if (auto it = visited.find(link); it != visited.end())
+            {
+                visitedLinksCount++;
+                it->second++;
+
+                // Only tell the frontier when the link moves up a priority tier
+                if (std::has_single_bit(it->second))
+                {
+                    toFilter.inLinks = it->second;
+                    toFilter.rediscovered = true;
+                    forward = true;
+                }
+            }
+            else if (std::none_of(disallowedLinks.cbegin(),
+                                  disallowedLinks.cend(),
+                                  [&link](const auto& disallowedLink) { return link.starts_with(disallowedLink); }))
+            {
+                goodLinksCount++;
+                visited.emplace(link, 1);
+                toFilter.inLinks = 1;
+                toFilter.rediscovered = false;
+                forward = true;
+            }
         }
 
-        if (visited.contains(toFilter))
+        if (forward)
         {
-            visitedLinksCount++;
-            continue;
+            TRACE_SPAN("filter:handoff", toFilter.link);
+            if (co_await outQueue.push(toFilter))
+            {
+                break;
+            }
         }
+    }
+    std::cout << "Terminating filter" << std::endl;
+}
+
+// Hands the scheduler the best links of every host with room for more. When stopping, the scheduler stops serving the
+// fetchers and the links waiting there are spilled to disk with the frontier. wakeUp is notified for new input, room in
+// the scheduler and stopping.
+Task dispatchLinks(LinksToDispatchQueue& inQueue, AsyncSignal& wakeUp, LinksToSerializeQueue& serializeQueue, HostScheduler& scheduler,
+                   const SpillIndex& spillIndex, RefillRequestQueue& refillRequests, std::atomic<std::size_t>& frontierSize)
+{
+    // Above this many links in memory the worst tiers are spilled to disk, below the low one they are read back
+    constexpr std::size_t frontierHighWatermark = 1 << 17;
+    constexpr std::size_t frontierLowWatermark = 1 << 14;
+    // Input drained in one go before going back to feeding the fetchers
+    constexpr std::size_t maxUpdatesPerRound = 256;
 
-        const bool isDisallowed = std::any_of(disallowedLinks.cbegin(),
-                                              disallowedLinks.cend(),
-                                              [&toFilter](const auto& disallowedLink) { return toFilter.starts_with(disallowedLink); });
+    PriorityFrontier frontier(scheduler.hostNames());
+    FrontierLink link;
+    bool stopping = false;
 
-        if (isDisallowed)
+    const auto apply = [&frontier](const FrontierLink& update)
+    {
+        TRACE_SPAN("dispatch:update", update.link);
+        if (update.rediscovered)
         {
-            continue;
+            frontier.bump(update.link, update.inLinks);
         }
-
-        goodLinksCount++;
-
-        visited.insert(toFilter);
-        if (outQueue.push(toFilter))
+        else
         {
-            inQueue.quit();
-            std::cout << "Terminating filter" << std::endl;
-            break;
+            frontier.push(update);
         }
-    }
-}
+    };
 
-void dispatchLinks(LinksToDispatchQueue& inQueue, LinksToCurlThrottleQueue& curlQueue, LinksToSerializeQueue& serializeQueue,
-                   std::condition_variable& deserializeCondition, std::atomic<bool>& quitDeserialize)
-{
-    std::string link;
     while (true)
     {
-        const float fullness = static_cast<float>(curlQueue.size()) / curlQueue.capacity();
-        if (fullness < 0.75f && shouldStop == false)
+        if (stopping == false && shouldStop == true)
         {
-            deserializeCondition.notify_one();
+            stopping = true;
+            scheduler.stopServing();
         }
 
-        if (inQueue.pop(link))
+        // A host only gets links while it has room in the scheduler, the others go on without waiting for one that is behind
+        if (stopping == false)
+        {
+            for (auto host = 0UL; host < frontier.hostCount(); host++)
+            {
+                while (scheduler.hasRoom(host) && frontier.pop(host, link))
+                {
+                    // On the link's own track, the gap up to its fetch is the time it waited on its host
+                    TRACE_SPAN("dispatch", link.link);
+                    scheduler.enqueue(link);
+                }
+            }
+        }
+
+        bool quit = false;
+        while (quit == false && frontier.size() > frontierHighWatermark && frontier.popWorst(link))
+        {
+            quit = co_await serializeQueue.push(link);
+        }
+        // Throttled pages keep coming back to the scheduler for a while after stopping, so this goes on until cancelled
+        while (quit == false && stopping && (frontier.popWorst(link) || scheduler.takeAny(link)))
+        {
+            quit = co_await serializeQueue.push(link);
+        }
+        frontierSize.store(frontier.size(), std::memory_order_relaxed);
+        if (quit)
         {
-            curlQueue.quit();
-            serializeQueue.quit();
-            quitDeserialize = true;
-            deserializeCondition.notify_all();
-            std::cout << "Terminating dispatch" << std::endl;
             break;
         }
 
-        if (fullness > 0.98f || shouldStop == true)
+        const std::size_t bestSpilledTier = spillIndex.bestTier();
+        if (stopping == false && bestSpilledTier != PriorityTiers &&
+            (frontier.size() < frontierLowWatermark || bestSpilledTier < frontier.bestTier()))
         {
-            if (serializeQueue.push(link))
+            refillRequests.tryPush(bestSpilledTier);
+        }
+
+        if (frontier.empty() && stopping == false)
+        {
+            if (co_await inQueue.pop(link))
             {
-                inQueue.quit();
-                curlQueue.quit();
-                quitDeserialize = true;
-                deserializeCondition.notify_all();
-                std::cout << "Terminating dispatch" << std::endl;
                 break;
             }
+            apply(link);
+            continue;
         }
-        else
+
+        std::size_t updates = 0;
+        while (updates < maxUpdatesPerRound && inQueue.tryPop(link))
+        {
+            apply(link);
+            updates++;
+        }
+
+        if (updates == 0)
         {
-            if (curlQueue.push(link))
+            // Every host with links in the frontier is behind (or we are stopping) and nothing new came in. Waiting on
+            // the input alone would leave the scheduler without links once it catches up.
+            if (inQueue.closed() || co_await wakeUp.wait())
             {
-                inQueue.quit();
-                serializeQueue.quit();
-                quitDeserialize = true;
-                deserializeCondition.notify_all();
-                std::cout << "Terminating dispatch" << std::endl;
                 break;
             }
         }
     }
+    std::cout << "Terminating dispatch" << std::endl;
 }
 
-void serializeLinks(LinksToSerializeQueue& inQueue, const std::string& linksFolder)
+// Spilled links are written in batches, one directory per priority tier: linksFolder/<tier>/<file>
+Task serializeLinks(LinksToSerializeQueue& inQueue, const std::string& linksFolder, SpillIndex& spillIndex)
 {
-    std::atomic<std::uint32_t> counter = 0;
-    std::vector<std::string> links;
-    links.resize(std::min(256ul, inQueue.capacity() / 2));
+    constexpr std::size_t linksPerFile = 256;
 
-    while (true)
-    {
-        if (inQueue.pop(links))
-        {
-            std::cout << "Terminating serialize" << std::endl;
-            break;
-        }
+    std::uint32_t counter = 0;
+    std::vector<FrontierLink> batch;
 
-        std::uint32_t fileNumber = counter.fetch_add(1);
-        std::string file = std::filesystem::path(linksFolder) / std::filesystem::path(std::to_string(fileNumber));
-        std::ofstream stream(file);
+    const auto writeBatch = [&]()
+    {
+        const std::size_t tier = priorityTier(batch.front().depth, batch.front().inLinks);
+        const auto tierFolder = std::filesystem::path(linksFolder) / std::to_string(tier);
+        std::filesystem::create_directories(tierFolder);
 
-        if (!stream)
+        // Written under a temporary name so the deserializer never picks up a half written file
+        std::uint32_t fileNumber = counter++;
+        std::string file = tierFolder / std::to_string(fileNumber);
         {
-            std::cerr << "Couldn't create file " << fileNumber << std::endl;
-            exit(1);
-        }
+            std::ofstream stream(file + ".part");
+            if (!stream)
+            {
+                std::cerr << "Couldn't create file " << file << std::endl;
+                exit(1);
+            }
 
-        for (const auto& link : links)
-        {
-            stream << link << '\n';
+            for (const auto& link : batch)
+            {
+                stream << link.link << ' ' << link.depth << ' ' << link.inLinks << '\n';
+            }
         }
-    }
-
-    if (inQueue.size() == 0)
-    {
-        return;
-    }
-
-    std::uint32_t fileNumber = counter.fetch_add(1);
-    std::string file = std::filesystem::path(linksFolder) / std::filesystem::path(std::to_string(fileNumber));
-    std::ofstream stream(file);
+        std::filesystem::rename(file + ".part", file);
+        batch.clear();
+        spillIndex.files[tier]++;
+    };
 
-    if (!stream)
+    // Once closed, the channel keeps handing out what's left, so nothing is lost here
+    FrontierLink link;
+    while (co_await inQueue.pop(link) == false)
     {
-        std::cerr << "Couldn't create file " << fileNumber << std::endl;
-        exit(1);
+        if (spillIndex.addToBatch(std::move(link), linksPerFile, batch))
+        {
+            writeBatch();
+        }
     }
+    std::cout << "Terminating serialize" << std::endl;
 
-    std::string link;
-    while (inQueue.size() != 0)
+    for (auto tier = 0UL; tier < PriorityTiers; tier++)
     {
-        inQueue.pop(link);
-        stream << link << '\n';
+        if (spillIndex.takeBatch(tier, batch))
+        {
+            writeBatch();
+        }
     }
     std::cout << "Done serializing last links\n";
 }
 
-void deserializeLinks(LinksToDispatchQueue& toDispatch, LinksToCurlThrottleQueue& curlQueue, std::unordered_set<std::string>& activeFiles,
-                      std::mutex& filemutex, std::mutex& conditionMutex, std::condition_variable& deserializeCondition,
-                      std::atomic<bool>& quitDeserialize, const std::string& linksFolder)
+// Reads back the best spilled tier when dispatch asks for it
+Task deserializeLinks(LinksToDispatchQueue& toDispatch, SpillIndex& spillIndex, RefillRequestQueue& refillRequests,
+                      const std::string& linksFolder)
 {
     std::string pathStr;
+    std::vector<FrontierLink> batch;
+    std::size_t requestedTier;
     while (true)
     {
-        if (shouldStop == true)
+        if (co_await refillRequests.pop(requestedTier))
         {
-            return;
+            break;
         }
 
-        std::unique_lock<std::mutex> guard(conditionMutex);
-        deserializeCondition.wait(guard,
-                                  [&]
-                                  {
-                                      const float fullness = static_cast<float>(curlQueue.size() - 1) / curlQueue.capacity();
-                                      return fullness < 0.50f || quitDeserialize == true;
-                                  });
-
-        if (shouldStop == true)
+        // Spill files may have come in since the request was made
+        const std::size_t tier = spillIndex.bestTier();
+        if (shouldStop == true || tier == PriorityTiers)
         {
-            return;
+            continue;
         }
 
-        if (quitDeserialize == true)
+        // No file for the tier yet, only the serializer's unfilled batch: take it as is
+        if (spillIndex.files[tier].load(std::memory_order_relaxed) == 0)
         {
-            std::cout << "Terminating deserialize" << std::endl;
-            toDispatch.quit();
-            curlQueue.quit();
-            break;
+            bool quit = false;
+            spillIndex.takeBatch(tier, batch);
+            for (const auto& link : batch)
+            {
+                if (co_await toDispatch.push(link))
+                {
+                    quit = true;
+                    break;
+                }
+            }
+            if (quit)
+            {
+                break;
+            }
+            continue;
         }
 
         pathStr.clear();
-        for (const auto& path : std::filesystem::directory_iterator(linksFolder))
+        for (const auto& path : std::filesystem::directory_iterator(std::filesystem::path(linksFolder) / std::to_string(tier)))
         {
-            pathStr = path.path().string();
+            if (path.path().extension() != ".part")
             {
-                std::lock_guard<std::mutex> fileGuard(filemutex);
-                if (activeFiles.contains(pathStr) == false)
-                {
-                    activeFiles.insert(pathStr);
-                    break;
-                }
+                pathStr = path.path().string();
+                break;
             }
         }
 
         if (pathStr.empty())
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            co_await sleepFor(std::chrono::milliseconds(100));
             continue;
         }
 
@@ -427,12 +493,12 @@ void deserializeLinks(LinksToDispatchQueue& toDispatch, LinksToCurlThrottleQueue
             exit(1);
         }
 
-        std::string link;
+        FrontierLink link;
         bool quit = false;
         std::cout << "Deserializing page << " << pathStr << "\n";
-        while (stream >> link)
+        while (stream >> link.link >> link.depth >> link.inLinks)
         {
-            if (curlQueue.push(link))
+            if (co_await toDispatch.push(link))
             {
                 quit = true;
                 break;
@@ -441,8 +507,6 @@ void deserializeLinks(LinksToDispatchQueue& toDispatch, LinksToCurlThrottleQueue
 
         if (quit)
         {
-            toDispatch.quit();
-            std::cout << "Terminating deserialize" << std::endl;
             break;
         }
 
@@ -451,39 +515,26 @@ void deserializeLinks(LinksToDispatchQueue& toDispatch, LinksToCurlThrottleQueue
             std::cerr << "Couldn't delete file " << pathStr << std::endl;
             exit(1);
         }
-
-        {
-            std::lock_guard<std::mutex> fileGuard(filemutex);
-            activeFiles.erase(pathStr);
-        }
+        spillIndex.files[tier]--;
     }
+    std::cout << "Terminating deserialize" << std::endl;
 }
 
-void serializePage(PagesToSerializeQueue& inQueue, const std::string& dataFolder, std::atomic<std::uint32_t>& pageCounter)
+Task serializePage(PagesToSerializeQueue& inQueue, const std::string& dataFolder, std::atomic<std::uint32_t>& pageCounter)
 {
     std::pair<std::string, std::string> toSerialize;
 
-    auto start = std::chrono::high_resolution_clock::now();
     while (true)
     {
-        if (inQueue.pop(toSerialize))
+        if (co_await inQueue.pop(toSerialize))
         {
             std::cout << "Terminating serialize page" << std::endl;
             break;
         }
         auto& [pageName, pageLinks] = toSerialize;
-        std::replace(pageName.begin(), pageName.end(), '/', '_');
-
-        std::string_view realPageName = [&]
-        {
-            if (toSerialize.first.starts_with("_wiki_"))
-            {
-                return std::string_view(toSerialize.first.begin() + 6, toSerialize.first.end());
-            }
-            return std::string_view(toSerialize.first);
-        }();
+        TRACE_SPAN("serializePage", pageName);
 
-        auto path = std::filesystem::path(dataFolder) / realPageName;
+        auto path = std::filesystem::path(dataFolder) / pageFileName(pageName);
         std::ofstream stream(path);
         if (!stream)
         {
@@ -496,7 +547,74 @@ void serializePage(PagesToSerializeQueue& inQueue, const std::string& dataFolder
     }
 }
 
-std::pair<std::string, std::string> prepDataFolder(const std::string_view dataFolder)
+#ifdef WIKIPEDIA_PARSER_HAS_ZSTD
+// Runs on the CPU executor so compressing never holds up the disk writes, nor the parsers feeding pagesToSerialize
+Task compressPages(PagesToSerializeQueue& inQueue, CompressedPagesQueue& outQueue, PageCompressor& compressor, CompressionStats& stats)
+{
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    std::pair<std::string, std::string> toCompress;
+    std::string encoded;
+
+    while (true)
+    {
+        if (co_await inQueue.pop(toCompress))
+        {
+            break;
+        }
+        auto& [pageName, pageLinks] = toCompress;
+
+        CompressedPage page;
+        {
+            TRACE_SPAN("compressPage", pageName);
+            const auto start = std::chrono::steady_clock::now();
+            encodeLinks(pageLinks, encoded);
+            if (!compressor.compress(cctx, encoded, page))
+            {
+                continue;
+            }
+            const auto duration = std::chrono::steady_clock::now() - start;
+            stats.compressNs += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        }
+        stats.rawBytes += pageLinks.size();
+        stats.compressedBytes += page.payload.size();
+
+        page.name = std::move(pageName);
+        page.rawSize = pageLinks.size();
+        if (co_await outQueue.push(std::move(page)))
+        {
+            break;
+        }
+        // The compressors share their pool with the fetchers and the other stages, don't hold a worker through a backlog
+        co_await yieldNow();
+    }
+
+    ZSTD_freeCCtx(cctx);
+    std::cout << "Terminating compress page" << std::endl;
+}
+#endif
+
+Task writeCompressedPages(CompressedPagesQueue& inQueue, const std::string& dataFolder, std::atomic<std::uint32_t>& pageCounter)
+{
+    PageArchiveWriter writer(dataFolder);
+    CompressedPage page;
+
+    while (true)
+    {
+        if (co_await inQueue.pop(page))
+        {
+            std::cout << "Terminating write compressed page" << std::endl;
+            break;
+        }
+
+        TRACE_SPAN("writeCompressedPage", page.name);
+        if (writer.write(page))
+        {
+            pageCounter++;
+        }
+    }
+}
+
+std::pair<std::string, std::string> prepDataFolder(const std::string_view dataFolder, const std::vector<HostPolicy>& hosts)
 {
     if (std::filesystem::exists(dataFolder))
     {
@@ -510,14 +628,19 @@ std::pair<std::string, std::string> prepDataFolder(const std::string_view dataFo
 
     std::string pagesData = std::filesystem::path(dataFolder) / "wiki_data";
     std::filesystem::create_directory(pagesData);
+    for (const auto& host : hosts)
+    {
+        std::filesystem::create_directory(std::filesystem::path(pagesData) / host.name);
+    }
 
     return {linksToCurl, pagesData};
 }
 
-auto parseRobotsTxt()
+// Disallowed paths come back host qualified, like the links they are matched against
+auto parseRobotsTxt(CurlShare& share, const std::string& host)
 {
-    auto [curl, responseString] = initCurl();
-    curl_easy_setopt(curl, CURLOPT_URL, "https://en.wikipedia.org/robots.txt");
+    auto [curl, responseString] = initCurl(share.get());
+    curl_easy_setopt(curl, CURLOPT_URL, std::string("https://" + host + "/robots.txt").c_str());
     curl_easy_perform(curl);
     std::stringstream stream(*responseString);
 
@@ -545,7 +668,7 @@ auto parseRobotsTxt()
             }
             if (line.starts_with("Disallow: "))
             {
-                std::string disallowedLink = line.substr(strlen("Disallow: "), std::string::npos);
+                std::string disallowedLink = host + line.substr(strlen("Disallow: "), std::string::npos);
                 disallowedLinks.push_back(disallowedLink);
             }
         }
@@ -577,94 +700,227 @@ void handleSigInt()
     sigaction(SIGINT, &sigIntHandler, nullptr);
 }
 
+#ifdef WIKIPEDIA_PARSER_TRACING
+// kill -USR1 <pid> writes the trace file
+void handleSigUsr1()
+{
+    struct sigaction sigUsr1Handler;
+    sigUsr1Handler.sa_handler = [](std::int32_t) { Tracer::requestDump(); };
+
+    sigemptyset(&sigUsr1Handler.sa_mask);
+    sigUsr1Handler.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sigUsr1Handler, nullptr);
+}
+#endif
+
 int main(int argc, char** argv)
 {
     handleSigInt();
+    const Options options = parseOptions(argc, argv);
 
-    std::vector<std::string> disallowedLinks = parseRobotsTxt();
-    auto [linksFolder, dataFolder] = prepDataFolder(argc < 3 ? "data/" : argv[2]);
+    if (!options.tracePath.empty())
+    {
+#ifdef WIKIPEDIA_PARSER_TRACING
+        Tracer::enable(options.tracePath);
+        handleSigUsr1();
+#else
+        std::cerr << "Built without WIKIPEDIA_PARSER_TRACING, ignoring --trace" << std::endl;
+#endif
+    }
+#ifndef WIKIPEDIA_PARSER_HAS_ZSTD
+    if (options.compressOutput)
+    {
+        std::cerr << "Built without zstd, --compress isn't available" << std::endl;
+        exit(1);
+    }
+#else
+    if (options.compressOutput && (options.compressionLevel < ZSTD_minCLevel() || options.compressionLevel > ZSTD_maxCLevel()))
+    {
+        std::cerr << "--compression-level must be between " << ZSTD_minCLevel() << " and " << ZSTD_maxCLevel() << std::endl;
+        exit(1);
+    }
+#endif
 
-    std::vector<std::thread> threads;
-    threads.reserve(64);
+    // Each host's robots.txt, plus what we never want from any of them
+    CurlShare curlShare;
+    std::vector<std::string> disallowedLinks;
+    for (const auto& host : options.hosts)
+    {
+        const std::vector<std::string> hostDisallowedLinks = parseRobotsTxt(curlShare, host.name);
+        disallowedLinks.insert(disallowedLinks.end(), hostDisallowedLinks.begin(), hostDisallowedLinks.end());
+        disallowedLinks.push_back(host.name + "/wiki/Category:");
+        disallowedLinks.push_back(host.name + "/wiki/File:");
+        disallowedLinks.push_back(host.name + "/wiki/Wikipedia:");
+    }
+    auto [linksFolder, dataFolder] = prepDataFolder(options.dataFolder, options.hosts);
+
+    // Every stage is a coroutine. CPU bound stages share a pool sized to the machine, the ones writing to disk get their own
+    // small pool so a slow disk never holds up parsing. Any stage returning cancels the scope, which closes every queue.
+    TaskScope pipeline;
+
+    // Per host politeness, the fetchers take their links from it. Declared before the executors, whose timers it uses.
+    // Dispatch is woken up when a host has room for more links, along with new input and stopping.
+    AsyncSignal dispatchWakeUp{pipeline.stopToken()};
+    HostScheduler hostScheduler(options.hosts, pipeline.stopToken());
+    hostScheduler.notifyOnRoom(dispatchWakeUp);
+    for (auto& seed : seedLinks(options))
+    {
+        FrontierLink link{std::move(seed), 0, 1};
+        hostScheduler.enqueue(link);
+    }
 
-    // Throttle
-    LinksToCurlQueue toCurl{};
-    LinksToCurlThrottleQueue toCurlThrottle{};
-    toCurlThrottle.push(std::string(argc <= 2 ? "/wiki/Sun" : argv[1]));
-    threads.emplace_back(throttleFetch, std::chrono::milliseconds(0), 2, std::ref(toCurlThrottle), std::ref(toCurl));
+    // With --numa, every node gets parsers pinned to its cores and fetchers of its own handing them pages, while the other
+    // stages, the I/O pool and the curl reactor keep to a few service cores per node. It does nothing on a single node.
+    std::vector<NodePlacement> placement;
+    if (options.numaPlacement)
+    {
+        placement = planPlacement(readNumaNodes(), options.serviceCoresPerNode);
+        if (placement.empty())
+        {
+            std::cout << "Single NUMA node, --numa has nothing to place\n";
+        }
+        for (const auto& node : placement)
+        {
+            std::cout << "Node " << node.node << ": " << node.parserCpus.size() << " parser cores, " << node.serviceCpus.size()
+                      << " service cores\n";
+        }
+    }
+    const std::vector<unsigned> serviceCores = serviceCpus(placement);
+    const std::size_t nodeCount = std::max<std::size_t>(placement.size(), 1);
+
+    // Parsers always get threads of their own. A parser only suspends once its input runs dry, so on a shared pool a
+    // parse backlog would take every worker and leave the fetchers resumed by the reactor waiting in the queues.
+    const std::size_t cores = std::max(std::thread::hardware_concurrency(), 1U);
+    const std::size_t serviceThreads = std::max<std::size_t>(2, cores / 4);
+    Executor cpuExecutor(placement.empty() ? serviceThreads : serviceCores.size(), serviceCores);
+    Executor ioExecutor(2, serviceCores);
+    CurlReactor curlReactor(pipeline.stopToken(), serviceCores);
+    std::vector<std::unique_ptr<Executor>> fetchExecutors;
+    std::vector<std::unique_ptr<Executor>> parserExecutors;
+    for (const auto& node : placement)
+    {
+        fetchExecutors.push_back(std::make_unique<Executor>(node.serviceCpus.size(), node.serviceCpus));
+        parserExecutors.push_back(std::make_unique<Executor>(node.parserCpus.size(), node.parserCpus));
+    }
+    if (placement.empty())
+    {
+        parserExecutors.push_back(std::make_unique<Executor>(cores > serviceThreads ? cores - serviceThreads : 1));
+    }
 
-    // Curl threads
-    std::atomic<std::uint64_t> throttleQuantity = 0;
-    HtmlToParseQueue toParse{};
-    const std::uint8_t numberOfCurlThreads = 30;
-    for (auto i = 0UL; i < numberOfCurlThreads; i++)
+    // Fetches (concurrent transfers on the curl reactor), as many per host since each has its own budget
+    HtmlToParseQueues toParse;
+    for (auto i = 0UL; i < nodeCount; i++)
+    {
+        toParse.push_back(std::make_unique<HtmlToParseQueue>(pipeline.stopToken()));
+    }
+    const std::size_t numberOfCurlThreadsPerHost = 30;
+    FetchStats fetchStats;
+    for (const auto& host : options.hosts)
+    {
+        // All at once before the fetchers start, each one leaves a connection in the reactor's pool
+        TaskScope warmUp;
+        std::atomic<std::size_t> warmConnections = 0;
+        for (auto i = 0UL; i < numberOfCurlThreadsPerHost; i++)
+        {
+            warmUp.spawn(cpuExecutor, warmUpConnection(curlReactor, curlShare, "https://" + host.name + "/", warmConnections));
+        }
+        warmUp.wait();
+        std::cout << "Warmed up " << warmConnections << '/' << numberOfCurlThreadsPerHost << " connections to " << host.name << '\n';
+    }
+    for (auto i = 0UL; i < numberOfCurlThreadsPerHost * options.hosts.size(); i++)
     {
-        threads.emplace_back(fetchPages, std::ref(toCurl), std::ref(toParse), std::ref(throttleQuantity));
+        const std::size_t node = i % nodeCount;
+        Executor& executor = placement.empty() ? cpuExecutor : *fetchExecutors[node];
+        pipeline.spawn(executor, fetchPages(hostScheduler, toParse, node, curlShare, curlReactor, fetchStats));
     }
 
-    // Parsing threads
-    PagesToSerializeQueue pagesToSerialize{};
-    LinksToFilterQueue toFilter{};
-    for (auto i = 0UL; i < 10; i++)
+    // Parsers, one per parser thread. Each creates its lexbor document once it runs, so with --numa it's allocated on its node.
+    PagesToSerializeQueue pagesToSerialize{pipeline.stopToken()};
+    LinksToFilterQueue toFilter{pipeline.stopToken()};
+    std::atomic<std::uint32_t> extractedLinksCount = 0;
+    std::atomic<std::uint32_t> emittedLinksCount = 0;
+    std::vector<std::atomic<std::uint32_t>> parsedPagesCounts(nodeCount);
+    for (auto node = 0UL; node < nodeCount; node++)
     {
-        threads.emplace_back(
-            parseHtml, std::ref(toParse), std::ref(toFilter), std::ref(pagesToSerialize), std::ref(throttleQuantity), numberOfCurlThreads);
+        Executor& executor = *parserExecutors[node];
+        for (auto i = 0UL; i < executor.threadCount(); i++)
+        {
+            pipeline.spawn(executor,
+                           parseHtml(*toParse[node],
+                                     toFilter,
+                                     pagesToSerialize,
+                                     hostScheduler,
+                                     options.linkPolicy,
+                                     extractedLinksCount,
+                                     emittedLinksCount,
+                                     parsedPagesCounts[node]));
+        }
     }
 
-    // Filter thread (did we already visit that link?)
+    // Filter (did we already visit that link?)
     std::atomic<std::uint32_t> goodLinksCount = 0;
     std::atomic<std::uint32_t> visitedLinksCount = 0;
-    std::condition_variable deserializeCondition;
-    LinksToDispatchQueue toDispatch{};
-    threads.emplace_back(filterLinks,
-                         std::ref(toFilter),
-                         std::ref(toDispatch),
-                         std::ref(toCurlThrottle),
-                         std::ref(deserializeCondition),
-                         std::ref(disallowedLinks),
-                         std::ref(goodLinksCount),
-                         std::ref(visitedLinksCount));
-
-    // Dispatching threads (should a link be serialized or be kept in memory?)
-    LinksToSerializeQueue toSerialize{};
-    std::atomic<bool> quitDeserialize = false;
-    threads.emplace_back(dispatchLinks,
-                         std::ref(toDispatch),
-                         std::ref(toCurlThrottle),
-                         std::ref(toSerialize),
-                         std::ref(deserializeCondition),
-                         std::ref(quitDeserialize));
-
-    // Serializing threads
-    threads.emplace_back(serializeLinks, std::ref(toSerialize), std::ref(linksFolder));
+    LinksToDispatchQueue toDispatch{pipeline.stopToken()};
+    toDispatch.notifyOnPush(dispatchWakeUp);
+    pipeline.spawn(cpuExecutor, filterLinks(toFilter, toDispatch, disallowedLinks, goodLinksCount, visitedLinksCount));
+
+    // Dispatch (holds the priority frontier, decides what gets fetched next and what gets spilled to disk)
+    LinksToSerializeQueue toSerialize{pipeline.stopToken()};
+    SpillIndex spillIndex;
+    RefillRequestQueue refillRequests{pipeline.stopToken()};
+    std::atomic<std::size_t> frontierSize = 0;
+    pipeline.spawn(cpuExecutor,
+                   dispatchLinks(toDispatch, dispatchWakeUp, toSerialize, hostScheduler, spillIndex, refillRequests, frontierSize));
+
+    // Serialize
+    pipeline.spawn(ioExecutor, serializeLinks(toSerialize, linksFolder, spillIndex));
 
     // Deserialize (when we are running out of links to visit in the memory, fetch them from the disk)
-    std::unordered_set<std::string> activeFiles;
-    std::mutex fileMutex;
-    std::mutex conditionMutex;
-    threads.emplace_back(deserializeLinks,
-                         std::ref(toDispatch),
-                         std::ref(toCurlThrottle),
-                         std::ref(activeFiles),
-                         std::ref(fileMutex),
-                         std::ref(conditionMutex),
-                         std::ref(deserializeCondition),
-                         std::ref(quitDeserialize),
-                         std::ref(linksFolder));
+    pipeline.spawn(ioExecutor, deserializeLinks(toDispatch, spillIndex, refillRequests, linksFolder));
 
+    // Serialize pages, either one file each or compressed (compression on the CPU executor, appending to segments on the I/O one)
     std::atomic<std::uint32_t> pageSerializingCounter = 0;
-    threads.emplace_back(serializePage, std::ref(pagesToSerialize), std::ref(dataFolder), std::ref(pageSerializingCounter));
+    CompressedPagesQueue compressedPages{pipeline.stopToken()};
+    CompressionStats compressionStats;
+#ifdef WIKIPEDIA_PARSER_HAS_ZSTD
+    PageCompressor pageCompressor(dataFolder, options.compressionLevel);
+#endif
+    if (options.compressOutput)
+    {
+#ifdef WIKIPEDIA_PARSER_HAS_ZSTD
+        const std::size_t numberOfCompressors = std::max(1U, std::thread::hardware_concurrency() / 4);
+        for (auto i = 0UL; i < numberOfCompressors; i++)
+        {
+            pipeline.spawn(cpuExecutor, compressPages(pagesToSerialize, compressedPages, pageCompressor, compressionStats));
+        }
+#endif
+        pipeline.spawn(ioExecutor, writeCompressedPages(compressedPages, dataFolder, pageSerializingCounter));
+    }
+    else
+    {
+        pipeline.spawn(ioExecutor, serializePage(pagesToSerialize, dataFolder, pageSerializingCounter));
+    }
     auto timestampAtStart = std::chrono::high_resolution_clock::now();
 
     // Every 5 seconds check if we have finished
     std::uint8_t count = 0;
     std::uint64_t totalPagesSerialized = 0;
+#ifdef WIKIPEDIA_PARSER_TRACING
+    // Tracing overhead is the time spent in spans out of the CPU time the whole process used
+    std::uint64_t lastTraceEvents = Tracer::recordedEvents();
+    std::clock_t lastCpuTime = std::clock();
+#endif
     while (true)
     {
         auto start = std::chrono::high_resolution_clock::now();
 
         std::this_thread::sleep_for(std::chrono::milliseconds(2500));
-        if (toCurlThrottle.size() == 0 && pagesToSerialize.size() == 0)
+        // The SIGINT handler can't do it, dispatch would otherwise only notice once something else wakes it up
+        if (shouldStop == true)
+        {
+            dispatchWakeUp.notify();
+        }
+        if (hostScheduler.pending() == 0 && pagesToSerialize.size() == 0 && compressedPages.size() == 0)
         {
             count++;
             if (count == 3)
@@ -690,34 +946,115 @@ int main(int argc, char** argv)
         while (!visitedLinksCount.compare_exchange_weak(visitedLinks, 0))
             ;
 
+        const std::uint32_t extractedLinks = extractedLinksCount.exchange(0, std::memory_order_relaxed);
+        const std::uint32_t emittedLinks = emittedLinksCount.exchange(0, std::memory_order_relaxed);
+
+        const std::uint64_t newConnections = fetchStats.newConnections.exchange(0, std::memory_order_relaxed);
+        const std::uint64_t reusedConnections = fetchStats.reusedConnections.exchange(0, std::memory_order_relaxed);
+        const std::uint64_t fetchErrors = fetchStats.errors.exchange(0, std::memory_order_relaxed);
+        fetchStats.requests.exchange(0, std::memory_order_relaxed);
+        const auto connectTimes = fetchStats.connectTime.snapshotAndReset();
+        const auto tlsTimes = fetchStats.tlsTime.snapshotAndReset();
+
+        const std::uint64_t rawBytes = compressionStats.rawBytes.exchange(0, std::memory_order_relaxed);
+        const std::uint64_t compressedBytes = compressionStats.compressedBytes.exchange(0, std::memory_order_relaxed);
+        const std::uint64_t compressNs = compressionStats.compressNs.exchange(0, std::memory_order_relaxed);
+
         auto now = std::chrono::high_resolution_clock::now();
         auto durationSinceLast = static_cast<float>(std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count());
         auto averageDuration = durationSinceLast / pageCount;
         auto durationSinceStart = static_cast<float>(std::chrono::duration_cast<std::chrono::milliseconds>(now - timestampAtStart).count());
 
         std::cout << "Queues fullness:\n";
-        std::cout << "To curl (throttled):      " << static_cast<float>(toCurlThrottle.size()) / toCurlThrottle.capacity() << '\n';
-        std::cout << "To curl:                  " << static_cast<float>(toCurl.size()) / toCurl.capacity() << '\n';
-        std::cout << "To parse:                 " << static_cast<float>(toParse.size()) / toParse.capacity();
-        std::cout << " [" << toParse.size() << '/' << toParse.capacity() << "]\n";
+        std::size_t toParseSize = 0;
+        for (const auto& queue : toParse)
+        {
+            toParseSize += queue->size();
+        }
+        const std::size_t toParseCapacity = toParse.size() * toParse.front()->capacity();
+        std::cout << "To parse:                 " << static_cast<float>(toParseSize) / toParseCapacity;
+        std::cout << " [" << toParseSize << '/' << toParseCapacity << "]\n";
         std::cout << "To filter:                " << static_cast<float>(toFilter.size()) / toFilter.capacity() << '\n';
         std::cout << "To dispatch:              " << static_cast<float>(toDispatch.size()) / toDispatch.capacity() << '\n';
         std::cout << "To serialize:             " << static_cast<float>(toSerialize.size()) / toSerialize.capacity() << '\n';
+        std::cout << "Frontier in memory:       " << frontierSize.load(std::memory_order_relaxed) << " links";
+        if (const std::size_t bestSpilledTier = spillIndex.bestTier(); bestSpilledTier != PriorityTiers)
+        {
+            std::cout << " [best spilled tier: " << bestSpilledTier << ']';
+        }
+        std::cout << '\n';
         std::cout << "To serialize pages:       " << static_cast<float>(pagesToSerialize.size()) / pagesToSerialize.capacity() << '\n';
         std::cout << "Number of fetches:        " << pageCount << " in the last " << durationSinceLast / 1000 << "s\n";
         std::cout << "% of new links:           " << static_cast<float>(newLinksCount) / (newLinksCount + visitedLinks) * 100 << "%";
         std::cout << " [" << newLinksCount << '/' << newLinksCount + visitedLinks << "]\n";
+        std::cout << "% of links emitted:       " << static_cast<float>(emittedLinks) / extractedLinks * 100 << "%";
+        std::cout << " [" << emittedLinks << '/' << extractedLinks << "]\n";
+        if (!placement.empty())
+        {
+            std::cout << "Pages parsed per node:    ";
+            for (auto node = 0UL; node < nodeCount; node++)
+            {
+                const std::uint32_t parsedPages = parsedPagesCounts[node].exchange(0, std::memory_order_relaxed);
+                std::cout << (node == 0 ? "" : ", ") << "node " << placement[node].node << ' ' << parsedPages << " ["
+                          << parsedPages / (durationSinceLast / 1000) << "pages/s]";
+            }
+            std::cout << '\n';
+        }
+        for (const auto& host : hostScheduler.snapshotAndReset())
+        {
+            std::cout << "Host " << host.name << ": " << host.served << " fetches [" << host.ready << " ready";
+            if (host.requestsPerSecond > 0)
+            {
+                std::cout << ", budget " << host.requestsPerSecond << "req/s";
+            }
+            std::cout << (host.paused ? ", backing off]\n" : "]\n");
+        }
         std::cout << "Fetch duration average:   " << averageDuration << "ms [" << 1000 / averageDuration << "req/s]\n";
+        std::cout << "Handshakes avoided:       " << reusedConnections << " [" << newConnections << " new connections, " << fetchErrors
+                  << " errors]\n";
+        std::cout << "Connect time p50/p90/p99: " << LatencyHistogram::percentile(connectTimes, 50) / 1000.f << '/'
+                  << LatencyHistogram::percentile(connectTimes, 90) / 1000.f << '/' << LatencyHistogram::percentile(connectTimes, 99) / 1000.f
+                  << "ms\n";
+        std::cout << "TLS time p50/p90/p99:     " << LatencyHistogram::percentile(tlsTimes, 50) / 1000.f << '/'
+                  << LatencyHistogram::percentile(tlsTimes, 90) / 1000.f << '/' << LatencyHistogram::percentile(tlsTimes, 99) / 1000.f
+                  << "ms\n";
+        if (options.compressOutput)
+        {
+            std::cout << "To write compressed:      " << static_cast<float>(compressedPages.size()) / compressedPages.capacity() << '\n';
+            std::cout << "Compression ratio:        " << static_cast<float>(rawBytes) / compressedBytes << "x ["
+                      << static_cast<float>(rawBytes) / compressNs * 1000 << "MB/s per compressor";
+#ifdef WIKIPEDIA_PARSER_HAS_ZSTD
+            std::cout << (pageCompressor.hasDictionary() ? ", with dictionary" : ", sampling for dictionary");
+#endif
+            std::cout << "]\n";
+        }
+#ifdef WIKIPEDIA_PARSER_TRACING
+        if (Tracer::enabled())
+        {
+            const std::uint64_t traceEvents = Tracer::recordedEvents();
+            const std::clock_t cpuTime = std::clock();
+            const double cpuNs = static_cast<double>(cpuTime - lastCpuTime) / CLOCKS_PER_SEC * 1e9;
+            const double tracingNs = static_cast<double>(traceEvents - lastTraceEvents) * Tracer::spanCostNs();
+            std::cout << "Tracing overhead:         " << tracingNs / cpuNs * 100 << "% of CPU time [" << traceEvents - lastTraceEvents
+                      << " spans, " << Tracer::spanCostNs() << "ns each]\n";
+            lastTraceEvents = traceEvents;
+            lastCpuTime = cpuTime;
+        }
+#endif
         std::cout << "Total pages serialized:   " << totalPagesSerialized << '\n';
         std::cout << "Time elapsed since start: " << durationSinceStart / 1000 << "s\n";
         std::cout << "---\n";
+
+#ifdef WIKIPEDIA_PARSER_TRACING
+        Tracer::dumpIfRequested();
+#endif
     }
 
     std::cout << "Terminating" << std::endl;
-    toDispatch.quit();
+    pipeline.cancel();
+    pipeline.wait();
 
-    for (auto& t : threads)
-    {
-        t.join();
-    }
+#ifdef WIKIPEDIA_PARSER_TRACING
+    Tracer::dump();
+#endif
 }
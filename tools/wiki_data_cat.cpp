@@ -0,0 +1,189 @@
+// Streams the pages of a compressed wiki_data folder (wikipedia_parser --compress) back as text.
+// Usage: wiki_data_cat <wiki_data folder | pages-*.wpz...> [--extract=<folder>]
+// Without --extract every page is written to stdout as "# <page>" followed by its links. With it, the plain
+// one file per page layout is recreated in that folder.
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zstd.h>
+#include "page_archive.h"
+
+class PageDecompressor
+{
+public:
+    PageDecompressor()
+        : m_dctx(ZSTD_createDCtx())
+    {
+    }
+
+    ~PageDecompressor()
+    {
+        ZSTD_freeDDict(m_dictionary);
+        ZSTD_freeDCtx(m_dctx);
+    }
+
+    PageDecompressor(const PageDecompressor&) = delete;
+    PageDecompressor& operator=(const PageDecompressor&) = delete;
+
+    // The dictionary sits next to the segments, it only has to be loaded once a record needs it
+    bool decompress(const std::filesystem::path& folder, const CompressedPage& page, std::string& links)
+    {
+        if ((page.flags & RecordUsesDictionary) != 0 && m_dictionary == nullptr && !loadDictionary(folder / DictionaryFileName))
+        {
+            return false;
+        }
+
+        const unsigned long long encodedSize = ZSTD_getFrameContentSize(page.payload.data(), page.payload.size());
+        if (encodedSize == ZSTD_CONTENTSIZE_ERROR || encodedSize == ZSTD_CONTENTSIZE_UNKNOWN)
+        {
+            std::cerr << "Corrupted record for " << page.name << std::endl;
+            return false;
+        }
+
+        m_encoded.resize(encodedSize);
+        const std::size_t size =
+            (page.flags & RecordUsesDictionary) != 0
+                ? ZSTD_decompress_usingDDict(m_dctx, m_encoded.data(), m_encoded.size(), page.payload.data(), page.payload.size(), m_dictionary)
+                : ZSTD_decompressDCtx(m_dctx, m_encoded.data(), m_encoded.size(), page.payload.data(), page.payload.size());
+        if (ZSTD_isError(size))
+        {
+            std::cerr << "Couldn't decompress " << page.name << ": " << ZSTD_getErrorName(size) << std::endl;
+            return false;
+        }
+
+        links.reserve(page.rawSize);
+        if (!decodeLinks(std::string_view(m_encoded.data(), size), links))
+        {
+            std::cerr << "Corrupted links for " << page.name << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool loadDictionary(const std::filesystem::path& path)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        const std::string dictionary((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        if (!stream || dictionary.empty())
+        {
+            std::cerr << "Can't read dictionary " << path << std::endl;
+            return false;
+        }
+        m_dictionary = ZSTD_createDDict(dictionary.data(), dictionary.size());
+        return m_dictionary != nullptr;
+    }
+
+    ZSTD_DCtx* m_dctx;
+    ZSTD_DDict* m_dictionary = nullptr;
+    std::string m_encoded;
+};
+
+static std::vector<std::filesystem::path> listSegments(const std::vector<std::string_view>& inputs)
+{
+    std::vector<std::filesystem::path> segments;
+    for (const auto input : inputs)
+    {
+        if (!std::filesystem::is_directory(input))
+        {
+            segments.emplace_back(input);
+            continue;
+        }
+
+        std::vector<std::filesystem::path> folderSegments;
+        for (const auto& entry : std::filesystem::directory_iterator(input))
+        {
+            if (entry.path().extension() == ".wpz")
+            {
+                folderSegments.push_back(entry.path());
+            }
+        }
+        // Segment names are zero padded, so this is the order they were written in
+        std::sort(folderSegments.begin(), folderSegments.end());
+        segments.insert(segments.end(), folderSegments.begin(), folderSegments.end());
+    }
+    return segments;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string_view> inputs;
+    std::string extractFolder;
+    for (auto i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        if (arg.starts_with("--extract="))
+        {
+            extractFolder = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.starts_with("--"))
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            exit(1);
+        }
+        else
+        {
+            inputs.push_back(arg);
+        }
+    }
+
+    if (inputs.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " <wiki_data folder | pages-*.wpz...> [--extract=<folder>]" << std::endl;
+        exit(1);
+    }
+    if (!extractFolder.empty())
+    {
+        std::filesystem::create_directories(extractFolder);
+    }
+
+    PageDecompressor decompressor;
+    CompressedPage page;
+    std::string links;
+    std::uint64_t pageCount = 0;
+    for (const auto& segment : listSegments(inputs))
+    {
+        PageArchiveReader reader(segment);
+        if (!reader.valid())
+        {
+            std::cerr << "Not a page archive: " << segment << std::endl;
+            exit(1);
+        }
+
+        while (reader.next(page))
+        {
+            if (!decompressor.decompress(segment.parent_path(), page, links))
+            {
+                exit(1);
+            }
+
+            if (extractFolder.empty())
+            {
+                std::cout << "# " << page.name << '\n' << links;
+            }
+            else
+            {
+                const auto path = std::filesystem::path(extractFolder) / pageFileName(page.name);
+                std::filesystem::create_directories(path.parent_path());
+                std::ofstream stream(path);
+                if (!stream)
+                {
+                    std::cerr << "Can't create file " << path << std::endl;
+                    exit(1);
+                }
+                stream << links;
+            }
+            pageCount++;
+        }
+    }
+
+    if (!extractFolder.empty())
+    {
+        std::cout << "Extracted " << pageCount << " pages to " << extractFolder << '\n';
+    }
+}